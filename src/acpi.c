@@ -1,6 +1,7 @@
 #include <efi.h>
 #include <printf.h>
 #include "csmwrap.h"
+#include "io.h"
 
 #include <uacpi/kernel_api.h>
 #include <uacpi/tables.h>
@@ -8,6 +9,10 @@
 
 uintptr_t g_rsdp = 0;
 
+uintptr_t pci_ecam_base = 0;
+uint8_t pci_ecam_bus_start = 0;
+uint8_t pci_ecam_bus_end = 0;
+
 static inline const char *uacpi_log_level_to_string(uacpi_log_level lvl) {
     switch (lvl) {
         case UACPI_LOG_DEBUG:
@@ -46,6 +51,43 @@ uacpi_status uacpi_kernel_get_rsdp(uacpi_phys_addr *rsdp) {
 
 static void *early_table_buffer;
 
+/* Use the MCFG window of PCI segment 0 for config space access, if any */
+static void acpi_find_ecam(void) {
+    uacpi_table tbl;
+    struct acpi_mcfg *mcfg;
+    size_t count;
+
+    if (uacpi_table_find_by_signature(ACPI_MCFG_SIGNATURE, &tbl) != UACPI_STATUS_OK) {
+        printf("No MCFG, using port I/O for PCI config space\n");
+        return;
+    }
+
+    mcfg = tbl.ptr;
+    count = (mcfg->hdr.length - sizeof(*mcfg)) / sizeof(mcfg->entries[0]);
+
+    for (size_t i = 0; i < count; i++) {
+        struct acpi_mcfg_allocation *alloc = &mcfg->entries[i];
+
+        if (alloc->segment != 0 || alloc->start_bus > alloc->end_bus) {
+            continue;
+        }
+
+        /* The whole window has to be reachable, it's relative to bus 0 */
+        if (alloc->address + ((uint64_t)(alloc->end_bus + 1) << 20) - 1 > UINTPTR_MAX) {
+            continue;
+        }
+
+        pci_ecam_base = (uintptr_t)alloc->address;
+        pci_ecam_bus_start = alloc->start_bus;
+        pci_ecam_bus_end = alloc->end_bus;
+        printf("PCI ECAM at %lx, buses %u-%u\n", (unsigned long)pci_ecam_base,
+               pci_ecam_bus_start, pci_ecam_bus_end);
+        break;
+    }
+
+    uacpi_table_unref(&tbl);
+}
+
 bool acpi_init(struct csmwrap_priv *priv) {
     UINTN i;
     EFI_GUID acpiGuid = ACPI_TABLE_GUID;
@@ -57,7 +99,7 @@ bool acpi_init(struct csmwrap_priv *priv) {
         table = gST->ConfigurationTable + i;
 
         if (!efi_guidcmp(table->VendorGuid, acpi2Guid)) {
-            printf("Found ACPI 2.0 RSDT at %x, copied to %x\n", (uintptr_t)table->VendorTable, (uintptr_t)table_target);
+            printf("Found ACPI 2.0 RSDT at %lx, copied to %lx\n", (unsigned long)table->VendorTable, (unsigned long)table_target);
             memcpy(table_target, table->VendorTable, sizeof(EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
             g_rsdp = (uintptr_t)table->VendorTable;
             break;
@@ -70,7 +112,7 @@ bool acpi_init(struct csmwrap_priv *priv) {
             table = gST->ConfigurationTable + i;
 
             if (!efi_guidcmp(table->VendorGuid, acpiGuid)) {
-                printf("Found ACPI 1.0 RSDT at %x, copied to %x\n", (uintptr_t)table->VendorTable, (uintptr_t)table_target);
+                printf("Found ACPI 1.0 RSDT at %lx, copied to %lx\n", (unsigned long)table->VendorTable, (unsigned long)table_target);
                 memcpy(table_target, table->VendorTable, sizeof(EFI_ACPI_1_0_ROOT_SYSTEM_DESCRIPTION_POINTER));
                 g_rsdp = (uintptr_t)table->VendorTable;
                 break;
@@ -92,6 +134,8 @@ bool acpi_init(struct csmwrap_priv *priv) {
             return false;
         }
 
+        acpi_find_ecam();
+
         return true;
     }
 
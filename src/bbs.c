@@ -0,0 +1,205 @@
+/*
+ * BIOS Boot Specification table built from what UEFI already found.
+ *
+ * Every BlockIo handle of a whole disk with media present is traced back
+ * to its PCI controller, and to its IDE channel for ATAPI device paths.
+ * AHCI ports have no HddInfo channel and go by PCI location.
+ * The table goes to the CSM with Legacy16UpdateBbs, so the boot priority
+ * of each controller is known before the CSM probes its devices.
+ */
+
+#include <efi.h>
+#include <csmwrap.h>
+#include <bbs.h>
+
+struct bbs_disk {
+    uint8_t bus;
+    uint8_t devfn;
+    /* IDE channel, or -1 if not on one */
+    int channel;
+    int slave;
+    bool usb;
+    bool removable;
+    uint32_t block_size;
+};
+
+static EFI_STATUS bbs_trace_disk(EFI_HANDLE handle, EFI_BLOCK_IO_PROTOCOL *block_io,
+                                 struct bbs_disk *disk)
+{
+    EFI_STATUS Status;
+    EFI_GUID DevicePathGuid = EFI_DEVICE_PATH_PROTOCOL_GUID;
+    EFI_DEVICE_PATH *DevicePath, *node;
+
+    Status = gBS->HandleProtocol(handle, &DevicePathGuid, (VOID **)&DevicePath);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    disk->channel = -1;
+    disk->slave = 0;
+    disk->usb = false;
+    disk->removable = block_io->Media->RemovableMedia;
+    disk->block_size = block_io->Media->BlockSize;
+
+    for (node = DevicePath; !IsDevicePathEnd(node); node = NextDevicePathNode(node)) {
+        if (DevicePathType(node) != MESSAGING_DEVICE_PATH) {
+            continue;
+        }
+
+        switch (DevicePathSubType(node)) {
+        case MSG_ATAPI_DP: {
+            ATAPI_DEVICE_PATH *atapi = (ATAPI_DEVICE_PATH *)node;
+            disk->channel = atapi->PrimarySecondary;
+            disk->slave = atapi->SlaveMaster;
+            break;
+        }
+        case MSG_USB_DP:
+            disk->usb = true;
+            break;
+        }
+    }
+
+    return pci_handle_location(handle, &disk->bus, &disk->devfn);
+}
+
+/*
+ * The IDE entries belong to the HddInfo channels, two BBS entries each.
+ * A disk only gets one if hddinfo_build() put its controller and channel
+ * there, everything else goes by PCI location. Returns -1 if none.
+ */
+static int bbs_ata_index(struct csmwrap_priv *priv, const struct bbs_disk *disk)
+{
+    const HDD_INFO *info = priv->low_stub->boot_table.HddInfo;
+
+    if (disk->channel < 0 || disk->channel > 1) {
+        return -1;
+    }
+
+    for (int i = disk->channel; i < MAX_IDE_CONTROLLER; i += 2) {
+        if ((info[i].Status & (HDD_PRIMARY | HDD_SECONDARY)) &&
+            info[i].Bus == disk->bus &&
+            info[i].Device == PCI_SLOT(disk->devfn) &&
+            info[i].Function == PCI_FUNC(disk->devfn)) {
+            return i * 2 + disk->slave;
+        }
+    }
+
+    return -1;
+}
+
+static void bbs_fill_entry(struct csmwrap_priv *priv, BBS_TABLE *entry,
+                           const struct bbs_disk *disk, uint16_t priority)
+{
+    const struct pci_device *dev = pci_find_device(&priv->pci, disk->bus, disk->devfn);
+
+    entry->BootPriority = priority;
+    entry->Bus = disk->bus;
+    entry->Device = PCI_SLOT(disk->devfn);
+    entry->Function = PCI_FUNC(disk->devfn);
+    if (dev) {
+        entry->Class = dev->class_code >> 16;
+        entry->SubClass = dev->class_code >> 8;
+    }
+
+    if (disk->usb) {
+        entry->DeviceType = BBS_USB;
+    } else if (disk->removable && disk->block_size == 2048) {
+        entry->DeviceType = BBS_CDROM;
+    } else {
+        entry->DeviceType = BBS_HARDDISK;
+    }
+
+    entry->StatusFlags.Enabled = 1;
+    /* Unknown if bootable */
+    entry->StatusFlags.MediaPresent = 1;
+}
+
+void bbs_build_table(struct csmwrap_priv *priv)
+{
+    EFI_STATUS Status;
+    EFI_GUID BlockIoGuid = EFI_BLOCK_IO_PROTOCOL_GUID;
+    EFI_HANDLE *HandleBuffer;
+    UINTN HandleCount;
+    BBS_TABLE *table = priv->low_stub->bbs_table;
+    unsigned int pci_count = 0;
+    /* Priority 0 is kept for the fast boot disk */
+    uint16_t priority = 1;
+    unsigned int count = 0;
+
+    for (size_t i = 0; i < BBS_TABLE_MAX; i++) {
+        table[i].BootPriority = BBS_IGNORE_ENTRY;
+    }
+
+    Status = gBS->LocateHandleBuffer(ByProtocol, &BlockIoGuid, NULL,
+                                     &HandleCount, &HandleBuffer);
+    if (EFI_ERROR(Status)) {
+        printf("No BlockIo handles for the BBS table\n");
+        return;
+    }
+
+    for (UINTN i = 0; i < HandleCount; i++) {
+        EFI_BLOCK_IO_PROTOCOL *BlockIo;
+        struct bbs_disk disk;
+        BBS_TABLE *entry = NULL;
+        int ata_index;
+
+        if (gBS->HandleProtocol(HandleBuffer[i], &BlockIoGuid, (VOID **)&BlockIo) != EFI_SUCCESS) {
+            continue;
+        }
+
+        /* Partitions share the entry of their disk */
+        if (!BlockIo->Media || BlockIo->Media->LogicalPartition ||
+            !BlockIo->Media->MediaPresent) {
+            continue;
+        }
+
+        if (bbs_trace_disk(HandleBuffer[i], BlockIo, &disk) != EFI_SUCCESS) {
+            continue;
+        }
+
+        ata_index = bbs_ata_index(priv, &disk);
+        if (ata_index >= 0 &&
+            table[BBS_ATA_FIRST + ata_index].BootPriority == BBS_IGNORE_ENTRY) {
+            entry = &table[BBS_ATA_FIRST + ata_index];
+        } else {
+            /* The CSM matches PCI entries by location, one per controller is enough */
+            bool seen = false;
+
+            for (unsigned int j = 0; j < pci_count; j++) {
+                BBS_TABLE *pci_entry = &table[BBS_PCI_FIRST + j];
+                if (pci_entry->Bus == disk.bus &&
+                    pci_entry->Device == PCI_SLOT(disk.devfn) &&
+                    pci_entry->Function == PCI_FUNC(disk.devfn)) {
+                    if (HandleBuffer[i] == priv->fastboot_handle) {
+                        pci_entry->BootPriority = 0;
+                    }
+                    seen = true;
+                    break;
+                }
+            }
+            if (seen) {
+                continue;
+            }
+            if (pci_count == BBS_PCI_MAX) {
+                printf("BBS table full, %02x:%02x.%x left out\n",
+                       disk.bus, PCI_SLOT(disk.devfn), PCI_FUNC(disk.devfn));
+                continue;
+            }
+            entry = &table[BBS_PCI_FIRST + pci_count++];
+        }
+
+        if (HandleBuffer[i] == priv->fastboot_handle) {
+            bbs_fill_entry(priv, entry, &disk, 0);
+        } else {
+            bbs_fill_entry(priv, entry, &disk, priority++);
+        }
+        count++;
+    }
+
+    gBS->FreePool(HandleBuffer);
+
+    priv->low_stub->boot_table.BbsTable = (uint32_t)(uintptr_t)table;
+    priv->low_stub->boot_table.NumberBbsEntries = BBS_PCI_FIRST + pci_count;
+
+    printf("BBS table: %u boot devices, %u PCI entries\n", count, pci_count);
+}
@@ -0,0 +1,22 @@
+#ifndef BBS_H
+#define BBS_H
+
+#include <efi.h>
+#include <edk2/LegacyBios.h>
+
+struct csmwrap_priv;
+
+/*
+ * Entry 0 is the floppy and entries 1 to 2 * MAX_IDE_CONTROLLER the IDE
+ * channels, master then slave, as laid out by EDK2 and expected by the
+ * SeaBIOS CSM. PCI controllers follow.
+ */
+#define BBS_ATA_FIRST       1
+#define BBS_PCI_FIRST       (BBS_ATA_FIRST + 2 * MAX_IDE_CONTROLLER)
+#define BBS_PCI_MAX         16
+#define BBS_TABLE_MAX       (BBS_PCI_FIRST + BBS_PCI_MAX)
+
+/* Fills low_stub's BBS table from BlockIo, needs boot services */
+void bbs_build_table(struct csmwrap_priv *priv);
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * Built-in boot path microbenchmarks, enabled with "make BENCHMARK=1".
+ */
+
+#include <efi.h>
+#include <csmwrap.h>
+#include <io.h>
+#include <timestamp.h>
+
+#ifdef CSMWRAP_BENCHMARK
+
+#define BENCH_POOL_SIZE     0x40000     /* Same order as the low stub memset */
+#define BENCH_SHADOW_SIZE   (VGABIOS_END - VGABIOS_START)
+
+/* What libc.c used to do, volatile so the compiler can't turn it into a call */
+static void bytewise_copy(volatile uint8_t *dest, const volatile uint8_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        dest[i] = src[i];
+    }
+}
+
+static void bytewise_set(volatile uint8_t *s, uint8_t c, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        s[i] = c;
+    }
+}
+
+static void bench_report(const char *name, size_t bytes, uint64_t byte_cycles, uint64_t libc_cycles)
+{
+    struct timestamp_table *ts = timestamp_get_table();
+    uint64_t mhz = ts ? ts->tick_freq_mhz : 0;
+
+    printf("bench %-16s %7lu bytes: bytewise %10llu cycles, libc %10llu cycles",
+           name, (unsigned long)bytes, (unsigned long long)byte_cycles,
+           (unsigned long long)libc_cycles);
+    if (mhz && byte_cycles && libc_cycles) {
+        printf(" (%llu -> %llu MB/s)", (unsigned long long)(bytes * mhz / byte_cycles),
+               (unsigned long long)(bytes * mhz / libc_cycles));
+    }
+    printf("\n");
+}
+
+static void bench_copy(const char *name, void *dest, const void *src, size_t n)
+{
+    uint64_t t0, t1, t2;
+
+    t0 = rdtsc();
+    bytewise_copy(dest, src, n);
+    t1 = rdtsc();
+    memcpy(dest, src, n);
+    t2 = rdtsc();
+
+    bench_report(name, n, t1 - t0, t2 - t1);
+}
+
+static void bench_set(const char *name, void *s, size_t n)
+{
+    uint64_t t0, t1, t2;
+
+    t0 = rdtsc();
+    bytewise_set(s, 0, n);
+    t1 = rdtsc();
+    memset(s, 0, n);
+    t2 = rdtsc();
+
+    bench_report(name, n, t1 - t0, t2 - t1);
+}
+
+/*
+ * Compare the old byte loops against libc.c on ordinary RAM and on the
+ * PAM shadowed VGA BIOS window, which must be unlocked already. The window
+ * is saved and restored, nothing is placed there before the final ROM copy.
+ */
+void bench_libc(void)
+{
+    uint8_t *src, *dest, *shadow = (uint8_t *)VGABIOS_START;
+
+    if (gBS->AllocatePool(EfiLoaderData, BENCH_POOL_SIZE, (void **)&src) != EFI_SUCCESS) {
+        return;
+    }
+    if (gBS->AllocatePool(EfiLoaderData, BENCH_POOL_SIZE, (void **)&dest) != EFI_SUCCESS) {
+        gBS->FreePool(src);
+        return;
+    }
+
+    bench_copy("memcpy ram", dest, src, BENCH_POOL_SIZE);
+    bench_set("memset ram", dest, BENCH_POOL_SIZE);
+
+    memcpy(dest, shadow, BENCH_SHADOW_SIZE);
+    bench_copy("memcpy shadow", shadow, src, BENCH_SHADOW_SIZE);
+    bench_set("memset shadow", shadow, BENCH_SHADOW_SIZE);
+    memcpy(shadow, dest, BENCH_SHADOW_SIZE);
+
+    gBS->FreePool(dest);
+    gBS->FreePool(src);
+}
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * Boot plan cache, lets warm boots skip the unlock and video probing.
+ */
+
+#include <efi.h>
+#include <csmwrap.h>
+#include <fs.h>
+#include <bootplan.h>
+
+static struct bootplan cached_plan;
+static bool cached_plan_valid;
+
+static uint32_t bootplan_checksum(const struct bootplan *plan)
+{
+    const uint8_t *p = (const uint8_t *)plan;
+    uint32_t sum = 0;
+
+    for (size_t i = 0; i < offsetof(struct bootplan, checksum); i++) {
+        sum = (sum << 1 | sum >> 31) + p[i];
+    }
+
+    return sum;
+}
+
+/*
+ * Read the cache, it is only kept if it was written on the same host
+ * bridge and firmware revision. Call after pci_scan() and before
+ * unlock_bios_region().
+ */
+void bootplan_load(struct csmwrap_priv *priv)
+{
+    struct bootplan *plan = &cached_plan;
+    UINTN size = sizeof(*plan);
+    EFI_STATUS status;
+
+    cached_plan_valid = false;
+
+    status = fs_read_image_file(priv->image_handle, BOOTPLAN_FILE_NAME, plan, &size);
+    if (EFI_ERROR(status)) {
+        return;
+    }
+
+    if (size != sizeof(*plan) ||
+        plan->signature != BOOTPLAN_SIGNATURE ||
+        plan->version != BOOTPLAN_VERSION ||
+        plan->size != sizeof(*plan) ||
+        plan->checksum != bootplan_checksum(plan)) {
+        printf("Boot plan cache invalid, probing\n");
+        return;
+    }
+
+    if (plan->host_bridge_id != pci_host_bridge_id(&priv->pci) ||
+        plan->firmware_revision != gST->FirmwareRevision) {
+        printf("Boot plan cache is for another platform, probing\n");
+        return;
+    }
+
+    printf("Boot plan cache: unlock %d, video %d\n", plan->unlock_method, plan->video_type);
+    cached_plan_valid = true;
+}
+
+const struct bootplan *bootplan_get(void)
+{
+    return cached_plan_valid ? &cached_plan : NULL;
+}
+
+/*
+ * The video part of the plan, only once the GOP device has been found
+ * and is the same one as last time.
+ */
+const struct bootplan *bootplan_get_video(struct csmwrap_priv *priv)
+{
+    const struct bootplan *plan = bootplan_get();
+
+    if (!plan || !priv->vga_pci_io ||
+        plan->gop_pci_id != priv->vga_pci_id ||
+        plan->gop_pci_bus != priv->vga_pci_bus ||
+        plan->gop_pci_devfn != priv->vga_pci_devfn) {
+        return NULL;
+    }
+
+    return plan;
+}
+
+/*
+ * Record what worked this time. The file is only rewritten when the plan
+ * changed, so warm boots don't write to the ESP.
+ */
+void bootplan_save(struct csmwrap_priv *priv)
+{
+    struct bootplan plan;
+    EFI_STATUS status;
+
+    /* The fallback is not worth remembering, probe again next time */
+    if (priv->video_type != CSMWRAP_VIDEO_OPROM &&
+        priv->video_type != CSMWRAP_VIDEO_SEAVGABIOS) {
+        return;
+    }
+
+    memset(&plan, 0, sizeof(plan));
+    plan.signature = BOOTPLAN_SIGNATURE;
+    plan.version = BOOTPLAN_VERSION;
+    plan.size = sizeof(plan);
+    plan.host_bridge_id = pci_host_bridge_id(&priv->pci);
+    plan.firmware_revision = gST->FirmwareRevision;
+    plan.gop_pci_id = priv->vga_pci_id;
+    plan.gop_pci_bus = priv->vga_pci_bus;
+    plan.gop_pci_devfn = priv->vga_pci_devfn;
+    plan.unlock_method = priv->unlock_method;
+    plan.video_type = priv->video_type;
+    plan.rom_offset = priv->vga_rom_offset;
+    plan.checksum = bootplan_checksum(&plan);
+
+    if (cached_plan_valid && !memcmp(&plan, &cached_plan, sizeof(plan))) {
+        return;
+    }
+
+    status = fs_write_image_file(priv->image_handle, BOOTPLAN_FILE_NAME, &plan, sizeof(plan));
+    if (EFI_ERROR(status)) {
+        printf("Unable to write boot plan cache (status: %lx)\n", (unsigned long)status);
+        return;
+    }
+
+    printf("Boot plan cache updated\n");
+}
@@ -0,0 +1,40 @@
+#ifndef BOOTPLAN_H
+#define BOOTPLAN_H
+
+#include <stdint.h>
+#include <csmwrap.h>
+
+#define BOOTPLAN_FILE_NAME  L"csmwrap.cache"
+#define BOOTPLAN_SIGNATURE  0x50425743  /* "CWBP" */
+#define BOOTPLAN_VERSION    1
+
+/*
+ * What worked on the previous boot, stored next to our image so warm
+ * boots can go straight to it. Only trusted while the key still matches.
+ */
+struct bootplan {
+    uint32_t signature;
+    uint16_t version;
+    uint16_t size;
+
+    /* Key */
+    uint32_t host_bridge_id;
+    uint32_t firmware_revision;
+    uint32_t gop_pci_id;
+    uint8_t gop_pci_bus;
+    uint8_t gop_pci_devfn;
+
+    /* Plan */
+    uint8_t unlock_method;
+    uint8_t video_type;
+    uint32_t rom_offset;
+
+    uint32_t checksum;
+} __attribute__((packed));
+
+void bootplan_load(struct csmwrap_priv *priv);
+const struct bootplan *bootplan_get(void);
+const struct bootplan *bootplan_get_video(struct csmwrap_priv *priv);
+void bootplan_save(struct csmwrap_priv *priv);
+
+#endif
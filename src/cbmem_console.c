@@ -0,0 +1,67 @@
+#include <efi.h>
+#include <csmwrap.h>
+#include <cbmem_console.h>
+
+/* Holds what is printed before cbmem_console_init() */
+#define EARLY_CONSOLE_SIZE      0x1000
+
+static struct {
+    struct cbmem_console hdr;
+    uint8_t body[EARLY_CONSOLE_SIZE];
+} early_console = {
+    .hdr.size = EARLY_CONSOLE_SIZE,
+};
+
+static struct cbmem_console *console = &early_console.hdr;
+static struct cbmem_console *cbmem_console;
+
+void cbmem_console_putc(uint8_t c)
+{
+    uint32_t cursor = console->cursor & CBMEM_CONSOLE_CURSOR_MASK;
+    uint32_t flags = console->cursor & ~CBMEM_CONSOLE_CURSOR_MASK;
+
+    if (cursor >= console->size) {
+        cursor = 0;
+        flags |= CBMEM_CONSOLE_OVERFLOW;
+    }
+
+    console->body[cursor++] = c;
+    console->cursor = flags | cursor;
+}
+
+/*
+ * Must be called with boot services alive. Moves everything printed so far
+ * into the new buffer, oldest first.
+ */
+void cbmem_console_init(void)
+{
+    EFI_PHYSICAL_ADDRESS addr = 0xffffffff;
+    struct cbmem_console *early = &early_console.hdr;
+    uint32_t cursor = early->cursor & CBMEM_CONSOLE_CURSOR_MASK;
+
+    if (gBS->AllocatePages(AllocateMaxAddress, EfiRuntimeServicesData,
+                           CBMEM_CONSOLE_SIZE / EFI_PAGE_SIZE, &addr) != EFI_SUCCESS) {
+        printf("Unable to alloc CBMEM console\n");
+        return;
+    }
+
+    cbmem_console = (struct cbmem_console *)(uintptr_t)addr;
+    cbmem_console->size = CBMEM_CONSOLE_SIZE - sizeof(struct cbmem_console);
+    cbmem_console->cursor = 0;
+
+    if (early->cursor & CBMEM_CONSOLE_OVERFLOW) {
+        memcpy(cbmem_console->body, early->body + cursor, early->size - cursor);
+        cbmem_console->cursor = early->size - cursor;
+    }
+    memcpy(cbmem_console->body + cbmem_console->cursor, early->body, cursor);
+    cbmem_console->cursor += cursor;
+
+    console = cbmem_console;
+
+    printf("CBMEM console at %lx\n", (unsigned long)cbmem_console);
+}
+
+struct cbmem_console *cbmem_console_get(void)
+{
+    return cbmem_console;
+}
@@ -0,0 +1,18 @@
+#ifndef CBMEM_CONSOLE_H
+#define CBMEM_CONSOLE_H
+
+#include <stdint.h>
+#include <edk2/Coreboot.h>
+
+/* coreboot's cursor layout: the low bits index the body, bit 31 flags a wrap */
+#define CBMEM_CONSOLE_CURSOR_MASK   ((1u << 28) - 1)
+#define CBMEM_CONSOLE_OVERFLOW      (1u << 31)
+
+/* Allocated as runtime data so it ends up reserved in E820 */
+#define CBMEM_CONSOLE_SIZE          0x10000
+
+void cbmem_console_init(void);
+void cbmem_console_putc(uint8_t c);
+struct cbmem_console *cbmem_console_get(void);
+
+#endif
@@ -1,5 +1,7 @@
 #include <efi.h>
 #include "csmwrap.h"
+#include "timestamp.h"
+#include "cbmem_console.h"
 
 static UINT16
 CbCheckSum16 (
@@ -54,6 +56,26 @@ int build_coreboot_table(struct csmwrap_priv *priv)
             table_entries++;
         }
 
+        /* cb_timestamps */
+        if (timestamp_get_table()) {
+            struct cb_cbmem_ref *timestamps = (struct cb_cbmem_ref *)p;
+            timestamps->tag = CB_TAG_TIMESTAMPS;
+            timestamps->size = sizeof(struct cb_cbmem_ref);
+            timestamps->cbmem_addr = (uintptr_t)timestamp_get_table();
+            p += timestamps->size;
+            table_entries++;
+        }
+
+        /* cb_cbmem_console */
+        if (cbmem_console_get()) {
+            struct cb_cbmem_ref *console = (struct cb_cbmem_ref *)p;
+            console->tag = CB_TAG_CBMEM_CONSOLE;
+            console->size = sizeof(struct cb_cbmem_ref);
+            console->cbmem_addr = (uintptr_t)cbmem_console_get();
+            p += console->size;
+            table_entries++;
+        }
+
         /* Last header stuff */
         header->table_entries = table_entries;
         header->table_bytes = (uint32_t)((uintptr_t)p - (uintptr_t)tables);
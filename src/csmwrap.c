@@ -4,6 +4,15 @@
 #include <io.h>
 #include <x86thunk.h>
 #include <video.h>
+#include <timestamp.h>
+#include <bootplan.h>
+#include <cbmem_console.h>
+#include <mtrr.h>
+#include <mp.h>
+#include <hddinfo.h>
+#include <ramdisk.h>
+#include <fastboot.h>
+#include <pmm.h>
 
 // Generated by: xxd -i Csm16.bin >> Csm16.h
 #include <bins/Csm16.h>
@@ -87,6 +96,8 @@ int set_smbios_table()
 
 EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
 {
+    /* TS_EFI_MAIN, recorded once the timestamp table exists */
+    uint64_t entry_tsc = rdtsc();
     EFI_PHYSICAL_ADDRESS HiPmm;
     uintptr_t csm_bin_base;
     EFI_STATUS Status;
@@ -94,23 +105,22 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
 
     gST = SystemTable;
     gBS = SystemTable->BootServices;
+    priv.image_handle = ImageHandle;
 
     printf("%s", banner);
 
+    timestamp_init(entry_tsc);
+    cbmem_console_init();
+    /* Both stay in use after ExitBS, keep them out of E820 compaction */
+    e820_keep(&priv, (uintptr_t)timestamp_get_table(), TIMESTAMP_TABLE_SIZE);
+    e820_keep(&priv, (uintptr_t)cbmem_console_get(), CBMEM_CONSOLE_SIZE);
+
     gBS->RaiseTPL(TPL_NOTIFY);
     gBS->SetWatchdogTimer(0, 0, 0, NULL);
 
-    if (unlock_bios_region()) {
-        printf("Unable to unlock BIOS region\n");
-        return -1;
-    }
-    printf("Unlock!\n");
-
-    apply_intel_platform_workarounds();
-
     csm_bin_base = (uintptr_t)BIOSROM_END - sizeof(Csm16_bin);
     priv.csm_bin_base = csm_bin_base;
-    printf("csm_bin_base: 0x%lx\n", csm_bin_base);
+    printf("csm_bin_base: 0x%lx\n", (unsigned long)csm_bin_base);
     if (csm_bin_base < VGABIOS_END) {
         printf("Illegal csm_bin size \n");
         return -1;
@@ -122,15 +132,51 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
         return -1;
     }
 
+    /* Before anything touches PCI, so config space goes through ECAM */
+    timestamp_add_now(TS_ACPI_INIT_START);
     acpi_init(&priv);
+    timestamp_add_now(TS_ACPI_INIT_END);
+
+    pci_scan(&priv.pci);
+
+    bootplan_load(&priv);
+
+    timestamp_add_now(TS_UNLOCK_REGION_START);
+    if (unlock_bios_region(&priv)) {
+        printf("Unable to unlock BIOS region\n");
+        return -1;
+    }
+    mtrr_set_legacy_region_wb();
+    timestamp_add_now(TS_UNLOCK_REGION_END);
+    printf("Unlock!\n");
+
+    timestamp_add_now(TS_PLATFORM_WORKAROUNDS_START);
+    apply_intel_platform_workarounds(&priv);
+    timestamp_add_now(TS_PLATFORM_WORKAROUNDS_END);
+
+#ifdef CSMWRAP_BENCHMARK
+    bench_libc();
+#endif
 
+    timestamp_add_now(TS_VIDEO_INIT_START);
     Status = csmwrap_video_init(&priv);
+    timestamp_add_now(TS_VIDEO_INIT_END);
+
+    /* Needs the VBIOS size to know where the shadow space left starts */
+    oprom_dispatch_collect(&priv);
+
+    ramdisk_load(&priv);
+    /* Before the BBS table, which puts the disk first */
+    fastboot_prepare(&priv);
+
+    bootplan_save(&priv);
 
     HiPmm = 0xffffffff;
     if (gBS->AllocatePages(AllocateMaxAddress, EfiRuntimeServicesData, HIPMM_SIZE / EFI_PAGE_SIZE, &HiPmm) != EFI_SUCCESS) {
         printf("Unable to alloc HiPmm!!!\n");
         return -1;
     }
+    e820_keep(&priv, HiPmm, HIPMM_SIZE);
 
     priv.low_stub = (struct low_stub *)LOW_STUB_BASE;
     memset((void*)LOW_STUB_BASE, 0, CONVEN_END - LOW_STUB_BASE);
@@ -140,20 +186,32 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
 
     uintptr_t pmm_base = LegacyBiosInitializeThunkAndTable(LOW_STUB_BASE, sizeof(struct low_stub));
 
-    printf("Init Thunk pmm: %lx\n", (uintptr_t)pmm_base);
+    printf("Init Thunk pmm: %lx\n", (unsigned long)pmm_base);
+
+#ifdef CSMWRAP_BENCHMARK
+    bench_thunk();
+#endif
 
     priv.low_stub->init_table.BiosLessThan1MB = 0x00080000; // Whole EBDA
     priv.low_stub->init_table.ThunkStart = (uint32_t)(uintptr_t)priv.low_stub;
     priv.low_stub->init_table.ThunkSizeInBytes = sizeof(struct low_stub);
     priv.low_stub->init_table.LowPmmMemory = (uint32_t)pmm_base;
-    priv.low_stub->init_table.LowPmmMemorySizeInBytes = (uint32_t)CONVEN_END - (uint32_t)pmm_base;
+    /* The RAM disk handler takes the top of low PMM */
+    uintptr_t low_pmm_end = priv.ramdisk_size ? RAMDISK_HANDLER_BASE : CONVEN_END;
+    priv.low_stub->init_table.LowPmmMemorySizeInBytes = (uint32_t)low_pmm_end - (uint32_t)pmm_base;
     priv.low_stub->init_table.HiPmmMemorySizeInBytes = HIPMM_SIZE;
     priv.low_stub->init_table.HiPmmMemory = HiPmm;
+#ifdef CSMWRAP_BENCHMARK
+    pmm_prepare(&priv);
+#endif
 
     priv.low_stub->vga_oprom_table.OpromSegment = EFI_SEGMENT(VGABIOS_START);
     priv.low_stub->vga_oprom_table.PciBus = priv.vga_pci_bus;
     priv.low_stub->vga_oprom_table.PciDeviceFunction = priv.vga_pci_devfn;
 
+    hddinfo_build(&priv);
+    bbs_build_table(&priv);
+
     build_coreboot_table(&priv);
 
     printf("CALL16 %x:%x\n", priv.csm_efi_table->Compatibility16CallSegment,
@@ -164,6 +222,7 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
     acpi_prepare_exitbs();
 
     /* WARNING: No EFI runtime service afterwards */
+    timestamp_add_now(TS_EXIT_BOOT_SERVICES_START);
     UINTN efi_mmap_size = 0, efi_desc_size = 0, efi_mmap_key = 0;
     UINT32 efi_desc_ver = 0;
     EFI_MEMORY_DESCRIPTOR *efi_mmap;
@@ -197,11 +256,17 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
 
     /* Disable external interrupts */
     asm volatile ("cli");
+    timestamp_add_now(TS_EXIT_BOOT_SERVICES_END);
+
+    /* Leave the BSP alone for legacy POST, the OS starts the APs again */
+    mp_park_aps();
 
+    timestamp_add_now(TS_E820_START);
     build_e820_map(&priv, efi_mmap, efi_mmap_size, efi_desc_size);
     uintptr_t e820_low = (uintptr_t)&priv.low_stub->e820_map;
     priv.csm_efi_table->E820Pointer = e820_low;
     priv.csm_efi_table->E820Length = sizeof(EFI_E820_ENTRY64) * priv.low_stub->e820_entries;
+    timestamp_add_now(TS_E820_END);
 
     /* Disable 8259 PIC */
     outb(0x21, 0xff);
@@ -214,43 +279,84 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
     /* Copy ROM to location, as late as possible */
     memcpy((void*)csm_bin_base, Csm16_bin, sizeof(Csm16_bin));
     memcpy((void*)VGABIOS_START, vbios_loc, vbios_size);
+    oprom_dispatch_shadow(&priv);
+
+    /* Everything up to Boot in a single trip to real mode */
+    LEGACY16_BATCH_STEP steps[4 + OPROM_DISPATCH_MAX];
+    size_t step_count = 0;
+
+    steps[step_count++] = (LEGACY16_BATCH_STEP) {
+        .Function = Legacy16InitializeYourself,
+        .TableSegment = EFI_SEGMENT(&priv.low_stub->init_table),
+        .TableOffset = EFI_OFFSET(&priv.low_stub->init_table),
+    };
+    steps[step_count++] = (LEGACY16_BATCH_STEP) {
+        .Function = Legacy16DispatchOprom,
+        .TableSegment = EFI_SEGMENT(&priv.low_stub->vga_oprom_table),
+        .TableOffset = EFI_OFFSET(&priv.low_stub->vga_oprom_table),
+    };
+    for (unsigned int i = 0; i < priv.oprom_count; i++) {
+        steps[step_count++] = (LEGACY16_BATCH_STEP) {
+            .Function = Legacy16DispatchOprom,
+            .TableSegment = EFI_SEGMENT(&priv.low_stub->oprom_tables[i]),
+            .TableOffset = EFI_OFFSET(&priv.low_stub->oprom_tables[i]),
+        };
+    }
+    size_t dispatch_end = step_count - 1;
+    if (priv.low_stub->boot_table.NumberBbsEntries) {
+        steps[step_count++] = (LEGACY16_BATCH_STEP) {
+            .Function = Legacy16UpdateBbs,
+            .TableSegment = EFI_SEGMENT(&priv.low_stub->boot_table),
+            .TableOffset = EFI_OFFSET(&priv.low_stub->boot_table),
+        };
+    }
+    steps[step_count++] = (LEGACY16_BATCH_STEP) {
+        .Function = Legacy16PrepareToBoot,
+        .TableSegment = EFI_SEGMENT(&priv.low_stub->boot_table),
+        .TableOffset = EFI_OFFSET(&priv.low_stub->boot_table),
+    };
+    uint64_t batch_start = rdtsc();
+
+    LegacyBiosBatchFarCall86(priv.csm_efi_table->Compatibility16CallSegment,
+                             priv.csm_efi_table->Compatibility16CallOffset,
+                             steps,
+                             step_count);
+
+    /* The dispatch stamps cover every OpROM, VGA first */
+    timestamp_add(TS_LEGACY16_INIT_START, batch_start);
+    timestamp_add(TS_LEGACY16_INIT_END, steps[0].EndTsc);
+    timestamp_add(TS_LEGACY16_DISPATCH_OPROM_START, steps[0].EndTsc);
+    timestamp_add(TS_LEGACY16_DISPATCH_OPROM_END, steps[dispatch_end].EndTsc);
+    timestamp_add(TS_LEGACY16_PREPARE_TO_BOOT_START, steps[step_count - 2].EndTsc);
+    timestamp_add(TS_LEGACY16_PREPARE_TO_BOOT_END, steps[step_count - 1].EndTsc);
+
+    for (size_t i = 0; i < step_count; i++) {
+        if (steps[i].Status) {
+            DEBUG((DEBUG_ERROR, "Legacy16 function %x failed: %x\n",
+                   steps[i].Function, steps[i].Status));
+        }
+    }
 
-    memset(&Regs, 0, sizeof(EFI_IA32_REGISTER_SET));
-    Regs.X.AX = Legacy16InitializeYourself;
-    Regs.X.ES = EFI_SEGMENT(&priv.low_stub->init_table);
-    Regs.X.BX = EFI_OFFSET(&priv.low_stub->init_table);
-
-    LegacyBiosFarCall86(priv.csm_efi_table->Compatibility16CallSegment,
-                        priv.csm_efi_table->Compatibility16CallOffset,
-                        &Regs,
-                        NULL,
-                        0);
+#ifdef CSMWRAP_BENCHMARK
+    pmm_report(&priv);
+    bench_legacy_region_mtrr(bench_int86);
+#endif
 
-    memset(&Regs, 0, sizeof(EFI_IA32_REGISTER_SET));
-    Regs.X.AX = Legacy16DispatchOprom;
-    Regs.X.ES = EFI_SEGMENT(&priv.low_stub->vga_oprom_table);
-    Regs.X.BX = EFI_OFFSET(&priv.low_stub->vga_oprom_table);
-    LegacyBiosFarCall86(priv.csm_efi_table->Compatibility16CallSegment,
-                        priv.csm_efi_table->Compatibility16CallOffset,
-                        &Regs,
-                        NULL,
-                        0);
+    if (DEBUG_PRINT_LEVEL & DEBUG_VERBOSE) {
+        LegacyBiosDumpThunkStats();
+    }
 
-    memset(&Regs, 0, sizeof(EFI_IA32_REGISTER_SET));
-    Regs.X.AX = Legacy16PrepareToBoot;
-    Regs.X.ES = EFI_SEGMENT(&priv.low_stub->boot_table);
-    Regs.X.BX = EFI_OFFSET(&priv.low_stub->boot_table);
+    ramdisk_install(&priv);
 
-    LegacyBiosFarCall86(priv.csm_efi_table->Compatibility16CallSegment,
-                        priv.csm_efi_table->Compatibility16CallOffset,
-                        &Regs,
-                        NULL,
-                        0);
+    if (priv.fastboot_handle && fastboot_boot(&priv) == 0) {
+        return 0;
+    }
 
     memset(&Regs, 0, sizeof(EFI_IA32_REGISTER_SET));
     Regs.X.AX = Legacy16Boot;
     // No arguments?
 
+    timestamp_add_now(TS_LEGACY16_BOOT);
     LegacyBiosFarCall86(priv.csm_efi_table->Compatibility16CallSegment,
                         priv.csm_efi_table->Compatibility16CallOffset,
                         &Regs,
@@ -9,6 +9,9 @@
 #include <edk2/Pci.h>
 #include <libc.h>
 #include <x86thunk.h>
+#include <pci.h>
+#include <oprom.h>
+#include <bbs.h>
 
 extern EFI_SYSTEM_TABLE *gST;
 extern EFI_BOOT_SERVICES *gBS;
@@ -20,13 +23,37 @@ enum csmwrap_video_type {
     CSMWRAP_VIDEO_FALLBACK,
 };
 
+enum csmwrap_unlock_method {
+    CSMWRAP_UNLOCK_NONE,
+    CSMWRAP_UNLOCK_ALREADY,
+    CSMWRAP_UNLOCK_PROTOCOL,
+    CSMWRAP_UNLOCK_PIIX4,
+    CSMWRAP_UNLOCK_Q35,
+    CSMWRAP_UNLOCK_SKYLAKE,
+    CSMWRAP_UNLOCK_AMD_MTRR,
+};
+
+/* Reserved ranges of our own that E820 compaction must never drop */
+#define E820_KEEP_MAX 8
+
+struct e820_range {
+    uint64_t base;
+    uint64_t size;
+};
+
 struct csmwrap_priv {
+    EFI_HANDLE image_handle;
     uint8_t *csm_bin;
 
     EFI_COMPATIBILITY16_TABLE *csm_efi_table;
     uintptr_t csm_bin_base;
     struct low_stub *low_stub;
 
+    enum csmwrap_unlock_method unlock_method;
+
+    /* Every PCI function, scanned once at startup */
+    struct pci_inventory pci;
+
     /* VGA stuff */
     enum csmwrap_video_type video_type;
     EFI_GRAPHICS_OUTPUT_PROTOCOL *gop;
@@ -34,15 +61,48 @@ struct csmwrap_priv {
     EFI_PCI_IO_PROTOCOL *vga_pci_io;
     uint8_t vga_pci_bus;
     uint8_t vga_pci_devfn;
+    uint32_t vga_pci_id;
+    /* Offset of the selected image within the device's ROM */
+    uintptr_t vga_rom_offset;
     struct cb_framebuffer cb_fb;
+
+    /* Non-VGA option ROMs, dispatched after the VBIOS */
+    unsigned int oprom_count;
+    struct oprom_dispatch oproms[OPROM_DISPATCH_MAX];
+
+    /* Disk image served as drive 80h, ramdisk_size is 0 without one */
+    uintptr_t ramdisk_base;
+    uint64_t ramdisk_size;
+    uint16_t ramdisk_cylinders;
+    uint16_t ramdisk_heads;
+    uint16_t ramdisk_spt;
+
+    /* Disk whose MBR is started directly, NULL for the normal boot */
+    EFI_HANDLE fastboot_handle;
+    uint8_t fastboot_bus;
+    uint8_t fastboot_devfn;
+
+    unsigned int e820_keep_count;
+    struct e820_range e820_keep[E820_KEEP_MAX];
+
+    /* E820 entries lost to fit E820_MAX_ENTRIES */
+    int e820_merged;
+    int e820_dropped;
 };
 
-extern int unlock_bios_region();
+extern int unlock_bios_region(struct csmwrap_priv *priv);
 extern int build_coreboot_table(struct csmwrap_priv *priv);
 bool acpi_init(struct csmwrap_priv *priv);
 void acpi_prepare_exitbs(void);
 int build_e820_map(struct csmwrap_priv *priv, EFI_MEMORY_DESCRIPTOR *memory_map, UINTN memory_map_size, UINTN descriptor_size);
-int apply_intel_platform_workarounds(void);
+void e820_keep(struct csmwrap_priv *priv, uint64_t base, uint64_t size);
+int apply_intel_platform_workarounds(struct csmwrap_priv *priv);
+
+#ifdef CSMWRAP_BENCHMARK
+void bench_libc(void);
+void bench_thunk(void);
+void bench_int86(void);
+#endif
 
 
 static inline int
@@ -61,6 +121,8 @@ struct low_stub {
     EFI_TO_COMPATIBILITY16_INIT_TABLE init_table;
     EFI_TO_COMPATIBILITY16_BOOT_TABLE boot_table;
     EFI_DISPATCH_OPROM_TABLE vga_oprom_table;
+    EFI_DISPATCH_OPROM_TABLE oprom_tables[OPROM_DISPATCH_MAX];
+    BBS_TABLE bbs_table[BBS_TABLE_MAX];
 
     /* E820 memory map */
     int e820_entries;
@@ -2,6 +2,7 @@
 
 #include <printf.h>
 #include "csmwrap.h"
+#include <ramdisk.h>
 
 /* This is not in E820.h */
 #define EfiAcpiAddressRangeHole     (-1UL)
@@ -18,41 +19,50 @@ e820_type_name(uint32_t type)
     }
 }
 
+/*
+ * A working E820 table. The final map handed to the CSM is bounded by
+ * E820_MAX_ENTRIES, but it is built in a larger staging table first.
+ */
+struct e820_table {
+    EFI_E820_ENTRY64 *map;
+    int count;
+    int max;
+    int merged;
+    int dropped;
+    const struct e820_range *keep;
+    int keep_count;
+};
+
 // Remove an entry from the e820_map.
 static void
-remove_e820(struct csmwrap_priv *priv, int i)
+remove_e820(struct e820_table *t, int i)
 {
-    EFI_E820_ENTRY64 *e820_map = priv->low_stub->e820_map;
-    int *e820_count = &priv->low_stub->e820_entries;
-
-    if (i < 0 || i >= *e820_count) {
+    if (i < 0 || i >= t->count) {
         DEBUG((DEBUG_ERROR, "e820_map remove index out of range\n"));
         return;
     }
 
-    (*e820_count)--;
-    memmove(&e820_map[i], &e820_map[i+1],
-            sizeof(EFI_E820_ENTRY64) * (*e820_count - i));
+    t->count--;
+    memmove(&t->map[i], &t->map[i+1],
+            sizeof(EFI_E820_ENTRY64) * (t->count - i));
 }
 
 // Insert an entry in the e820_map at the given position.
 static void
-insert_e820(struct csmwrap_priv *priv,
+insert_e820(struct e820_table *t,
             int i, uint64_t start, uint64_t size, uint64_t type)
 {
-    EFI_E820_ENTRY64 *e820_map = priv->low_stub->e820_map;
-    int *e820_count = &priv->low_stub->e820_entries;
-
-    if (*e820_count >= E820_MAX_ENTRIES) {
+    if (t->count >= t->max) {
         DEBUG((DEBUG_ERROR, "e820_map overflow\n"));
+        t->dropped++;
         return;
     }
 
-    memmove(&e820_map[i + 1], &e820_map[i],
-            sizeof(EFI_E820_ENTRY64) * (*e820_count - i));
+    memmove(&t->map[i + 1], &t->map[i],
+            sizeof(EFI_E820_ENTRY64) * (t->count - i));
 
-    (*e820_count)++;
-    EFI_E820_ENTRY64 *e = &e820_map[i];
+    t->count++;
+    EFI_E820_ENTRY64 *e = &t->map[i];
     e->BaseAddr = start;
     e->Length = size;
     e->Type = type;
@@ -60,36 +70,31 @@ insert_e820(struct csmwrap_priv *priv,
 
 // Show the current e820_map.
 static void
-dump_map(struct csmwrap_priv *priv)
+dump_map(struct e820_table *t)
 {
-    EFI_E820_ENTRY64 *e820_map = priv->low_stub->e820_map;
-    int e820_count = priv->low_stub->e820_entries;
-
-    printf("csmwrap e820 map has %d items:\n", e820_count);
+    printf("csmwrap e820 map has %d items:\n", t->count);
     int i;
-    for (i = 0; i < e820_count; i++) {
-        EFI_E820_ENTRY64 *e = &e820_map[i];
+    for (i = 0; i < t->count; i++) {
+        EFI_E820_ENTRY64 *e = &t->map[i];
         uint64_t e_end = e->BaseAddr + e->Length;
 
         printf("  %d: %016llx - %016llx = %d %s\n", i,
-               e->BaseAddr, e_end, e->Type, e820_type_name(e->Type));
+               (unsigned long long)e->BaseAddr, (unsigned long long)e_end, e->Type, e820_type_name(e->Type));
     }
 }
 
-void e820_add(struct csmwrap_priv *priv, uint64_t start,
-              uint64_t size, uint64_t type)
+static void
+e820_add(struct e820_table *t, uint64_t start,
+         uint64_t size, uint64_t type)
 {
-    EFI_E820_ENTRY64 *e820_map = priv->low_stub->e820_map;
-    int *e820_count = &priv->low_stub->e820_entries;
-
     if (!size)
         return;
 
     // Find position of new item (splitting existing item if needed).
     uint64_t end = start + size;
     int i;
-    for (i = 0; i < *e820_count; i++) {
-        EFI_E820_ENTRY64 *e = &e820_map[i];
+    for (i = 0; i < t->count; i++) {
+        EFI_E820_ENTRY64 *e = &t->map[i];
         uint64_t e_end = e->BaseAddr + e->Length;
         if (start > e_end)
             continue;
@@ -104,21 +109,21 @@ void e820_add(struct csmwrap_priv *priv, uint64_t start,
                 e->Length = start - e->BaseAddr;
                 i++;
                 if (e_end > end)
-                    insert_e820(priv, i, end, e_end - end, e->Type);
+                    insert_e820(t, i, end, e_end - end, e->Type);
             }
         }
         break;
     }
     // Remove/adjust existing items that are overlapping.
-    while (i < *e820_count) {
-        EFI_E820_ENTRY64 *e = &e820_map[i];
+    while (i < t->count) {
+        EFI_E820_ENTRY64 *e = &t->map[i];
         if (end < e->BaseAddr)
             // No overlap - done.
             break;
         uint64_t e_end = e->BaseAddr + e->Length;
         if (end >= e_end) {
             // Existing item completely overlapped - remove it.
-            remove_e820(priv, i);
+            remove_e820(t, i);
             continue;
         }
         // Not completely overlapped - adjust its start.
@@ -127,20 +132,20 @@ void e820_add(struct csmwrap_priv *priv, uint64_t start,
         if (type == e->Type) {
             // Same type - merge them.
             size += e->Length;
-            remove_e820(priv, i);
+            remove_e820(t, i);
         }
         break;
     }
     // Insert new item.
     if (type != EfiAcpiAddressRangeHole)
-        insert_e820(priv, i, start, size, type);
+        insert_e820(t, i, start, size, type);
 }
 
 // Remove any definitions in a memory range (make a memory hole).
-void
-e820_remove(struct csmwrap_priv *priv, uint64_t start, uint64_t size)
+static void
+e820_remove(struct e820_table *t, uint64_t start, uint64_t size)
 {
-    e820_add(priv, start, size, EfiAcpiAddressRangeHole);
+    e820_add(t, start, size, EfiAcpiAddressRangeHole);
 }
 
 /*
@@ -172,49 +177,450 @@ static uint32_t convert_memory_type(EFI_MEMORY_TYPE type)
     }
 }
 
+static void
+swap_e820(EFI_E820_ENTRY64 *a, EFI_E820_ENTRY64 *b)
+{
+    EFI_E820_ENTRY64 tmp = *a;
+
+    *a = *b;
+    *b = tmp;
+}
+
+static void
+sift_down_e820(EFI_E820_ENTRY64 *map, int root, int count)
+{
+    int child;
+
+    while ((child = 2 * root + 1) < count) {
+        if (child + 1 < count && map[child + 1].BaseAddr > map[child].BaseAddr)
+            child++;
+        if (map[root].BaseAddr >= map[child].BaseAddr)
+            return;
+        swap_e820(&map[root], &map[child]);
+        root = child;
+    }
+}
+
+// Heapsort entries by base address, no allocation and O(n log n) worst case.
+static void
+sort_e820(EFI_E820_ENTRY64 *map, int count)
+{
+    int i;
+
+    for (i = count / 2 - 1; i >= 0; i--)
+        sift_down_e820(map, i, count);
+    for (i = count - 1; i > 0; i--) {
+        swap_e820(&map[0], &map[i]);
+        sift_down_e820(map, 0, i);
+    }
+}
+
 /*
- * Build E820 memory map based on UEFI GetMemoryMap
- * Return the number of entries in the E820 map
+ * Convert the UEFI descriptors into E820 entries in place. An E820 entry
+ * is smaller than any EFI_MEMORY_DESCRIPTOR, so writing entry n never
+ * clobbers a descriptor that has not been read yet.
+ * Return the number of entries.
  */
-int build_e820_map(struct csmwrap_priv *priv, EFI_MEMORY_DESCRIPTOR *memory_map, UINTN memory_map_size, UINTN descriptor_size)
+static int
+convert_memory_map(EFI_MEMORY_DESCRIPTOR *memory_map, UINTN memory_map_size, UINTN descriptor_size)
 {
+    EFI_E820_ENTRY64 *staging = (EFI_E820_ENTRY64 *)memory_map;
     EFI_MEMORY_DESCRIPTOR *memory_map_end;
     EFI_MEMORY_DESCRIPTOR *memory_map_ptr;
+    int count = 0;
 
     memory_map_end = (EFI_MEMORY_DESCRIPTOR *)((uint8_t *)memory_map + memory_map_size);
 
-    /* Process each memory descriptor and convert to E820 format */
-    for (memory_map_ptr = memory_map; 
+    for (memory_map_ptr = memory_map;
          memory_map_ptr < memory_map_end;
          memory_map_ptr = NextMemoryDescriptor(memory_map_ptr, descriptor_size)) {
 
         uint64_t start = memory_map_ptr->PhysicalStart;
-        uint64_t end = start + (memory_map_ptr->NumberOfPages * EFI_PAGE_SIZE);
+        uint64_t size = memory_map_ptr->NumberOfPages * EFI_PAGE_SIZE;
         uint32_t type = convert_memory_type(memory_map_ptr->Type);
-        
+
         /* Skip zero-length regions */
-        if (start == end)
+        if (size == 0)
             continue;
 
         /* Skip memory types that are not reported in E820 */
         if (type == 0)
             continue;
 
-        e820_add(priv, start, end - start, type);
+        staging[count].BaseAddr = start;
+        staging[count].Length = size;
+        staging[count].Type = type;
+        count++;
+    }
+
+    return count;
+}
+
+/*
+ * Compaction picks the n cheapest of some kind of candidate at once: the
+ * smallest key wins and equal keys go to the lowest index, as taking them
+ * one at a time would. The key threshold is found by bisection between
+ * the smallest and largest candidate key, which costs a few dozen linear
+ * scans at most but needs no memory, there is no allocator left by the
+ * time the map is built.
+ */
+struct e820_pick {
+    uint64_t key;
+    /* Candidates at key itself to take, counted from the lowest index */
+    int ties;
+};
+
+// Candidate key of entry i, false if it is no candidate.
+typedef bool (*e820_key_fn)(const struct e820_table *t, const EFI_E820_ENTRY64 *prev,
+                            const EFI_E820_ENTRY64 *e, uint64_t *key);
+
+static int
+count_e820(const struct e820_table *t, e820_key_fn fn, uint64_t max_key)
+{
+    uint64_t key;
+    int count = 0;
+    int i;
+
+    for (i = 0; i < t->count; i++) {
+        if (fn(t, i ? &t->map[i - 1] : NULL, &t->map[i], &key) && key <= max_key)
+            count++;
+    }
+
+    return count;
+}
+
+// Returns false if there are no candidates or fewer than n.
+static bool
+pick_e820(const struct e820_table *t, e820_key_fn fn, int n, struct e820_pick *pick)
+{
+    uint64_t lo = ~0ULL, hi = 0, key;
+    int count = 0;
+    int i;
+
+    /* The threshold lies between the smallest and largest candidate key */
+    for (i = 0; i < t->count; i++) {
+        if (!fn(t, i ? &t->map[i - 1] : NULL, &t->map[i], &key))
+            continue;
+        lo = key < lo ? key : lo;
+        hi = key > hi ? key : hi;
+        count++;
+    }
+    if (n <= 0 || count < n)
+        return false;
+
+    if (n == count)
+        lo = hi;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+
+        if (count_e820(t, fn, mid) >= n)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    pick->key = lo;
+    pick->ties = n - (lo ? count_e820(t, fn, lo - 1) : 0);
+    return true;
+}
+
+static bool
+picked_e820(struct e820_pick *pick, uint64_t key)
+{
+    if (key < pick->key)
+        return true;
+    if (key == pick->key && pick->ties > 0) {
+        pick->ties--;
+        return true;
+    }
+    return false;
+}
+
+// Hole between e and the reserved entry before it.
+static bool
+reserved_gap_key(const struct e820_table *t, const EFI_E820_ENTRY64 *prev,
+                 const EFI_E820_ENTRY64 *e, uint64_t *key)
+{
+    (void)t;
+    if (!prev || prev->Type != EfiAcpiAddressRangeReserved ||
+        e->Type != EfiAcpiAddressRangeReserved)
+        return false;
+    *key = e->BaseAddr - (prev->BaseAddr + prev->Length);
+    return true;
+}
+
+static bool
+acpi_length_key(const struct e820_table *t, const EFI_E820_ENTRY64 *prev,
+                const EFI_E820_ENTRY64 *e, uint64_t *key)
+{
+    (void)t;
+    (void)prev;
+    if (e->Type != EfiAcpiAddressRangeACPI)
+        return false;
+    *key = e->Length;
+    return true;
+}
+
+static bool
+kept_e820(const struct e820_table *t, const EFI_E820_ENTRY64 *e)
+{
+    int i;
+
+    /* The EBDA and BIOS area must stay reserved */
+    if (e->BaseAddr < 0x100000)
+        return true;
+    for (i = 0; i < t->keep_count; i++) {
+        if (e->BaseAddr < t->keep[i].base + t->keep[i].size &&
+            t->keep[i].base < e->BaseAddr + e->Length)
+            return true;
+    }
+    return false;
+}
+
+static bool
+droppable_length_key(const struct e820_table *t, const EFI_E820_ENTRY64 *prev,
+                     const EFI_E820_ENTRY64 *e, uint64_t *key)
+{
+    (void)prev;
+    if (e->Type != EfiAcpiAddressRangeReserved || kept_e820(t, e))
+        return false;
+    *key = e->Length;
+    return true;
+}
+
+// Merge the n adjacent pairs of reserved entries with the smallest holes between them.
+static void
+merge_reserved_e820(struct e820_table *t, int n)
+{
+    int pairs = count_e820(t, reserved_gap_key, ~0ULL);
+    struct e820_pick pick;
+    EFI_E820_ENTRY64 prev;
+    int count = 0;
+    int i;
+
+    if (!pick_e820(t, reserved_gap_key, n < pairs ? n : pairs, &pick))
+        return;
+
+    for (i = 0; i < t->count; i++) {
+        EFI_E820_ENTRY64 e = t->map[i];
+        uint64_t gap;
+
+        if (i && reserved_gap_key(t, &prev, &e, &gap) && picked_e820(&pick, gap)) {
+            t->map[count - 1].Length = e.BaseAddr + e.Length - t->map[count - 1].BaseAddr;
+            t->merged++;
+        } else {
+            t->map[count++] = e;
+        }
+        prev = e;
+    }
+    t->count = count;
+}
+
+/*
+ * Turn the smallest ACPI reclaim entries into reserved, just enough of
+ * them to make n more reserved pairs that can be merged. The tables stay
+ * intact, the OS just won't get the memory back.
+ */
+static void
+demote_acpi_e820(struct e820_table *t, int n)
+{
+    int acpi = count_e820(t, acpi_length_key, ~0ULL);
+    struct e820_pick pick;
+    int lo = 1, hi = acpi;
+    int i;
+
+    if (!acpi)
+        return;
+
+    /* The pairs gained only grow with the number of entries demoted */
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        EFI_E820_ENTRY64 prev = { 0 };
+        int pairs = 0;
+
+        pick_e820(t, acpi_length_key, mid, &pick);
+        for (i = 0; i < t->count; i++) {
+            EFI_E820_ENTRY64 e = t->map[i];
+            uint64_t key;
+
+            if (acpi_length_key(t, NULL, &e, &key) && picked_e820(&pick, key))
+                e.Type = EfiAcpiAddressRangeReserved;
+            if (i && prev.Type == EfiAcpiAddressRangeReserved &&
+                e.Type == EfiAcpiAddressRangeReserved)
+                pairs++;
+            prev = e;
+        }
+
+        if (pairs >= n)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    if (!pick_e820(t, acpi_length_key, lo, &pick))
+        return;
+    for (i = 0; i < t->count; i++) {
+        uint64_t key;
+
+        if (acpi_length_key(t, NULL, &t->map[i], &key) && picked_e820(&pick, key))
+            t->map[i].Type = EfiAcpiAddressRangeReserved;
+    }
+}
+
+/*
+ * Drop the n smallest reserved entries, the OS will see holes there
+ * instead. The low 1MB and the ranges csmwrap reserved for itself are
+ * never dropped, or the OS could put MMIO over memory still in use.
+ */
+static void
+drop_reserved_e820(struct e820_table *t, int n)
+{
+    int droppable = count_e820(t, droppable_length_key, ~0ULL);
+    struct e820_pick pick;
+    int count = 0;
+    int i;
+
+    if (!pick_e820(t, droppable_length_key, n < droppable ? n : droppable, &pick))
+        return;
+
+    for (i = 0; i < t->count; i++) {
+        uint64_t key;
+
+        if (droppable_length_key(t, NULL, &t->map[i], &key) && picked_e820(&pick, key)) {
+            t->dropped++;
+            continue;
+        }
+        t->map[count++] = t->map[i];
+    }
+    t->count = count;
+}
+
+/*
+ * Shrink the table to at most max entries. Each step is only taken when
+ * the previous ones can't go any further, ordered by how little the OS
+ * loses: holes between reserved ranges, then ACPI reclaim memory, then
+ * small reserved ranges. RAM and NVS are never touched unless there is
+ * nothing else left, in which case the top of the map is cut off.
+ */
+static void
+compact_e820(struct e820_table *t, int max)
+{
+    if (t->count > max)
+        merge_reserved_e820(t, t->count - max);
+    if (t->count > max) {
+        demote_acpi_e820(t, t->count - max);
+        merge_reserved_e820(t, t->count - max);
+    }
+    if (t->count > max)
+        drop_reserved_e820(t, t->count - max);
+    if (t->count > max) {
+        t->dropped += t->count - max;
+        t->count = max;
+    }
+}
+
+/*
+ * Build E820 memory map based on UEFI GetMemoryMap
+ * Return the number of entries in the E820 map
+ *
+ * The descriptors are sorted once and adjacent ranges of the same type
+ * are coalesced in a single pass, which gives the same map as feeding
+ * them one by one to e820_add() without its O(n^2) memmove churn.
+ * UEFI forbids overlapping descriptors; if firmware hands us some anyway,
+ * let e820_add() resolve them.
+ *
+ * All of this happens in the memory map buffer, which has room for at
+ * least twice as many E820 entries as there are descriptors, so nothing
+ * is lost before the result is compacted into the low stub for the CSM.
+ */
+int build_e820_map(struct csmwrap_priv *priv, EFI_MEMORY_DESCRIPTOR *memory_map, UINTN memory_map_size, UINTN descriptor_size)
+{
+    EFI_E820_ENTRY64 *staging = (EFI_E820_ENTRY64 *)memory_map;
+    struct e820_table t = {
+        .map = staging,
+        .max = memory_map_size / sizeof(EFI_E820_ENTRY64),
+        .keep = priv->e820_keep,
+        .keep_count = priv->e820_keep_count,
+    };
+    int staging_count;
+    int i;
+
+    staging_count = convert_memory_map(memory_map, memory_map_size, descriptor_size);
+    sort_e820(staging, staging_count);
+
+    /* Merged entries are written behind the read position */
+    for (i = 0; i < staging_count; i++) {
+        EFI_E820_ENTRY64 *e = &staging[i];
+        EFI_E820_ENTRY64 *last = t.count ? &t.map[t.count - 1] : NULL;
+
+        if (last && e->BaseAddr < last->BaseAddr + last->Length) {
+            int remaining = staging_count - i;
+
+            DEBUG((DEBUG_ERROR, "Overlapping UEFI memory descriptors\n"));
+            /* Park the rest at the end of the buffer, out of e820_add()'s way */
+            t.max -= remaining;
+            memmove(&staging[t.max], e, sizeof(EFI_E820_ENTRY64) * remaining);
+            for (e = &staging[t.max]; remaining--; e++)
+                e820_add(&t, e->BaseAddr, e->Length, e->Type);
+            break;
+        }
+
+        if (last && last->Type == e->Type &&
+            last->BaseAddr + last->Length == e->BaseAddr) {
+            last->Length += e->Length;
+            continue;
+        }
+
+        t.map[t.count++] = *e;
     }
 
     /* Remove whole 1MB, we are going to fix it later */
-    e820_remove(priv, 0, 0x100000);
+    e820_remove(&t, 0, 0x100000);
     /* Add all low memory as usable */
-    e820_add(priv, 0, 0x80000, EfiAcpiAddressRangeMemory);
+    e820_add(&t, 0, 0x80000, EfiAcpiAddressRangeMemory);
     /* Reserve EBDA */
-    e820_add(priv, EBDA_BASE, 0x20000, EfiAcpiAddressRangeReserved);
+    e820_add(&t, EBDA_BASE, 0x20000, EfiAcpiAddressRangeReserved);
     /* Reserve Expansion BIOS */
-    e820_add(priv, 0xa0000, 0x100000 - 0xa0000, EfiAcpiAddressRangeReserved);
+    e820_add(&t, 0xa0000, 0x100000 - 0xa0000, EfiAcpiAddressRangeReserved);
+    /* Keep the RAM disk and its INT 13h handler away from the OS */
+    if (priv->ramdisk_size) {
+        e820_add(&t, RAMDISK_HANDLER_BASE, RAMDISK_HANDLER_SIZE, EfiAcpiAddressRangeReserved);
+        e820_add(&t, priv->ramdisk_base, ALIGN_UP(priv->ramdisk_size, EFI_PAGE_SIZE),
+                 EfiAcpiAddressRangeReserved);
+    }
+
+    compact_e820(&t, E820_MAX_ENTRIES);
+
+    memcpy(priv->low_stub->e820_map, t.map, sizeof(EFI_E820_ENTRY64) * t.count);
+    priv->low_stub->e820_entries = t.count;
+    priv->e820_merged = t.merged;
+    priv->e820_dropped = t.dropped;
+
+    if (t.merged || t.dropped) {
+        printf("e820: compacted to %d entries, %d merged, %d dropped\n",
+               t.count, t.merged, t.dropped);
+    }
 
     if (DEBUG_PRINT_LEVEL & DEBUG_VERBOSE) {
-        dump_map(priv);
+        dump_map(&t);
     }
 
     return 0;
 }
+
+/* Registers a range csmwrap reserved for itself, see E820_KEEP_MAX */
+void e820_keep(struct csmwrap_priv *priv, uint64_t base, uint64_t size)
+{
+    /* Nothing was allocated */
+    if (!base || !size)
+        return;
+
+    if (priv->e820_keep_count == E820_KEEP_MAX) {
+        DEBUG((DEBUG_ERROR, "e820 keep list full\n"));
+        return;
+    }
+
+    priv->e820_keep[priv->e820_keep_count].base = base;
+    priv->e820_keep[priv->e820_keep_count].size = size;
+    priv->e820_keep_count++;
+}
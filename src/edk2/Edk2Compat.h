@@ -47,7 +47,7 @@
 #define _DEBUG_PRINT(PrintLevel, ...)              \
     do {                                             \
       if (PrintLevel & DEBUG_PRINT_LEVEL) {     \
-        printf (#__VA_ARGS__);      \
+        printf (__VA_ARGS__);       \
       }                                              \
     } while (FALSE)
 #define _DEBUGLIB_DEBUG(Expression)  _DEBUG_PRINT Expression
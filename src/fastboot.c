@@ -0,0 +1,236 @@
+/*
+ * Direct boot of a known disk's MBR.
+ *
+ * Sector 0 of the selected BlockIo device is read before ExitBS and its
+ * BBS entry gets the top priority, so the CSM should map it to drive 80h
+ * in PrepareToBoot. Legacy16Boot and the INT 19h walk over every boot
+ * device are skipped, the MBR is started right away. If drive 80h turns
+ * out to be another disk, Legacy16Boot runs after all.
+ */
+
+#include <efi.h>
+#include <csmwrap.h>
+#include <fastboot.h>
+#include <timestamp.h>
+
+extern const uint8_t   m16FastBootStart;
+extern const uint16_t  m16FastBootSize;
+
+static uint8_t fastboot_mbr[512];
+
+static int hex_digit(CHAR16 c)
+{
+    if (c >= L'0' && c <= L'9') {
+        return c - L'0';
+    }
+    if (c >= L'a' && c <= L'f') {
+        return c - L'a' + 10;
+    }
+    if (c >= L'A' && c <= L'F') {
+        return c - L'A' + 10;
+    }
+    return -1;
+}
+
+/* Parses up to max_digits hex digits, returns -1 if there are none */
+static int parse_hex(const CHAR16 **p, const CHAR16 *end, int max_digits)
+{
+    int value = 0, digits = 0, d;
+
+    while (*p < end && digits < max_digits && (d = hex_digit(**p)) >= 0) {
+        value = value * 16 + d;
+        (*p)++;
+        digits++;
+    }
+
+    return digits ? value : -1;
+}
+
+/*
+ * Looks for FASTBOOT_OPTION in our load options. Returns false if it is
+ * not there, any_device is set when no PCI function is given.
+ */
+static bool fastboot_parse_options(struct csmwrap_priv *priv, bool *any_device)
+{
+    EFI_GUID LoadedImageGuid = EFI_LOADED_IMAGE_PROTOCOL_GUID;
+    EFI_LOADED_IMAGE_PROTOCOL *loaded_image;
+    const CHAR16 *opt, *end, *p;
+    const UINTN opt_len = ARRAY_SIZE(FASTBOOT_OPTION) - 1;
+    int bus, dev, fn;
+
+    if (gBS->HandleProtocol(priv->image_handle, &LoadedImageGuid,
+                            (void **)&loaded_image) != EFI_SUCCESS ||
+        !loaded_image->LoadOptions) {
+        return false;
+    }
+
+    opt = loaded_image->LoadOptions;
+    end = opt + loaded_image->LoadOptionsSize / sizeof(CHAR16);
+
+    for (p = opt; p + opt_len <= end; p++) {
+        if (memcmp(p, FASTBOOT_OPTION, opt_len * sizeof(CHAR16)) == 0) {
+            break;
+        }
+    }
+    if (p + opt_len > end) {
+        return false;
+    }
+
+    p += opt_len;
+    *any_device = true;
+    if (p >= end || *p != L'=') {
+        return true;
+    }
+
+    p++;
+    bus = parse_hex(&p, end, 2);
+    if (bus < 0 || p >= end || *p++ != L':') {
+        goto Invalid;
+    }
+    dev = parse_hex(&p, end, 2);
+    if (dev < 0 || dev > 0x1f || p >= end || *p++ != L'.') {
+        goto Invalid;
+    }
+    fn = parse_hex(&p, end, 1);
+    if (fn < 0 || fn > 7) {
+        goto Invalid;
+    }
+
+    priv->fastboot_bus = bus;
+    priv->fastboot_devfn = PCI_DEVFN(dev, fn);
+    *any_device = false;
+    return true;
+
+Invalid:
+    printf("Fast boot: expected fastboot=BB:DD.F\n");
+    return false;
+}
+
+/* Reads sector 0 into fastboot_mbr, true if it carries the boot signature */
+static bool fastboot_read_mbr(EFI_BLOCK_IO_PROTOCOL *BlockIo)
+{
+    UINT32 block_size = BlockIo->Media->BlockSize;
+    uint8_t *block;
+    bool ok = false;
+
+    if (block_size < sizeof(fastboot_mbr)) {
+        return false;
+    }
+
+    if (gBS->AllocatePool(EfiLoaderData, block_size, (void **)&block) != EFI_SUCCESS) {
+        return false;
+    }
+
+    if (BlockIo->ReadBlocks(BlockIo, BlockIo->Media->MediaId, 0, block_size, block) == EFI_SUCCESS &&
+        block[510] == 0x55 && block[511] == 0xaa) {
+        memcpy(fastboot_mbr, block, sizeof(fastboot_mbr));
+        ok = true;
+    }
+
+    gBS->FreePool(block);
+    return ok;
+}
+
+int fastboot_prepare(struct csmwrap_priv *priv)
+{
+    EFI_STATUS Status;
+    EFI_GUID BlockIoGuid = EFI_BLOCK_IO_PROTOCOL_GUID;
+    EFI_HANDLE *HandleBuffer;
+    UINTN HandleCount;
+    bool any_device;
+
+    priv->fastboot_handle = NULL;
+
+    if (!fastboot_parse_options(priv, &any_device)) {
+        return -1;
+    }
+
+    if (priv->ramdisk_size) {
+        printf("Fast boot: RAM disk takes drive 80h, booting it the usual way\n");
+        return -1;
+    }
+
+    Status = gBS->LocateHandleBuffer(ByProtocol, &BlockIoGuid, NULL,
+                                     &HandleCount, &HandleBuffer);
+    if (EFI_ERROR(Status)) {
+        return -1;
+    }
+
+    for (UINTN i = 0; i < HandleCount; i++) {
+        EFI_BLOCK_IO_PROTOCOL *BlockIo;
+        uint8_t bus, devfn;
+
+        if (gBS->HandleProtocol(HandleBuffer[i], &BlockIoGuid, (VOID **)&BlockIo) != EFI_SUCCESS ||
+            !BlockIo->Media || BlockIo->Media->LogicalPartition ||
+            !BlockIo->Media->MediaPresent) {
+            continue;
+        }
+
+        if (pci_handle_location(HandleBuffer[i], &bus, &devfn) != EFI_SUCCESS) {
+            continue;
+        }
+
+        if (!any_device && (bus != priv->fastboot_bus || devfn != priv->fastboot_devfn)) {
+            continue;
+        }
+
+        if (fastboot_read_mbr(BlockIo)) {
+            priv->fastboot_handle = HandleBuffer[i];
+            priv->fastboot_bus = bus;
+            priv->fastboot_devfn = devfn;
+            break;
+        }
+    }
+
+    gBS->FreePool(HandleBuffer);
+
+    if (!priv->fastboot_handle) {
+        printf("Fast boot: no bootable disk found\n");
+        return -1;
+    }
+
+    printf("Fast boot: MBR of disk at %02x:%02x.%x\n", priv->fastboot_bus,
+           PCI_SLOT(priv->fastboot_devfn), PCI_FUNC(priv->fastboot_devfn));
+    return 0;
+}
+
+/*
+ * Takes the place of Legacy16Boot, does not return when the MBR runs.
+ * Returns -1 if drive 80h is not the disk the MBR was read from, the
+ * CSM may have picked another one when a controller has several or the
+ * BBS table had no room for it.
+ */
+int fastboot_boot(struct csmwrap_priv *priv)
+{
+    EFI_IA32_REGISTER_SET Regs;
+    uintptr_t trampoline = FASTBOOT_MBR_BASE - ALIGN_UP(m16FastBootSize, 16);
+
+    (void)priv;
+
+    /* Sector 0 of drive 80h, CHS 0/0/1, straight to where it will run */
+    memset(&Regs, 0, sizeof(Regs));
+    Regs.H.AH = 0x02;
+    Regs.H.AL = 1;
+    Regs.X.CX = 0x0001;
+    Regs.H.DL = FASTBOOT_DRIVE;
+    Regs.X.ES = EFI_SEGMENT(FASTBOOT_MBR_BASE);
+    Regs.X.BX = EFI_OFFSET(FASTBOOT_MBR_BASE);
+    if (LegacyBiosInt86(0x13, &Regs) ||
+        memcmp((void *)FASTBOOT_MBR_BASE, fastboot_mbr, sizeof(fastboot_mbr)) != 0) {
+        printf("Fast boot: drive 80h is not the selected disk, booting the usual way\n");
+        return -1;
+    }
+
+    memcpy((void *)trampoline, &m16FastBootStart, m16FastBootSize);
+
+    /* As INT 19h starts a boot sector, the trampoline sets up SS:SP */
+    memset(&Regs, 0, sizeof(Regs));
+    Regs.X.AX = 0xaa55;
+    Regs.X.Flags.IF = 1;
+    Regs.H.DL = FASTBOOT_DRIVE;
+
+    timestamp_add_now(TS_LEGACY16_BOOT);
+    LegacyBiosFarCall86(EFI_SEGMENT(trampoline), EFI_OFFSET(trampoline), &Regs, NULL, 0);
+
+    return 0;
+}
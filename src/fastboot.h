@@ -0,0 +1,20 @@
+#ifndef FASTBOOT_H
+#define FASTBOOT_H
+
+#include <csmwrap.h>
+
+/*
+ * Load options selecting the fast boot path. "fastboot" alone takes the
+ * first disk with an MBR, "fastboot=BB:DD.F" the first one behind that
+ * PCI function.
+ */
+#define FASTBOOT_OPTION     L"fastboot"
+
+/* Where the MBR is staged, and the drive number it is started with */
+#define FASTBOOT_MBR_BASE   0x7c00
+#define FASTBOOT_DRIVE      0x80
+
+int fastboot_prepare(struct csmwrap_priv *priv);
+int fastboot_boot(struct csmwrap_priv *priv);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * Access to small files living next to our own image on its boot volume.
+ */
+
+#include <efi.h>
+#include <csmwrap.h>
+#include <fs.h>
+
+#define FS_PATH_MAX     256
+
+/*
+ * Build "<directory of the image>\<name>" from the FILEPATH nodes of the
+ * loaded image device path. Some firmware splits the path across several
+ * nodes, so all of them are concatenated.
+ */
+static EFI_STATUS fs_image_path(EFI_LOADED_IMAGE_PROTOCOL *loaded_image,
+                                const CHAR16 *name, CHAR16 *path)
+{
+    EFI_DEVICE_PATH *node;
+    UINTN len = 0, dir_len = 0;
+
+    for (node = loaded_image->FilePath; node && !IsDevicePathEnd(node);
+         node = NextDevicePathNode(node)) {
+        FILEPATH_DEVICE_PATH *fp = (FILEPATH_DEVICE_PATH *)node;
+        UINTN chars;
+
+        if (DevicePathType(node) != MEDIA_DEVICE_PATH ||
+            DevicePathSubType(node) != MEDIA_FILEPATH_DP) {
+            continue;
+        }
+
+        chars = (DevicePathNodeLength(node) - sizeof(EFI_DEVICE_PATH)) / sizeof(CHAR16);
+        for (UINTN i = 0; i < chars && fp->PathName[i]; i++) {
+            if (len >= FS_PATH_MAX - 1) {
+                return EFI_BUFFER_TOO_SMALL;
+            }
+            path[len++] = fp->PathName[i];
+        }
+    }
+
+    for (UINTN i = 0; i < len; i++) {
+        if (path[i] == L'\\') {
+            dir_len = i + 1;
+        }
+    }
+
+    if (dir_len == 0) {
+        path[dir_len++] = L'\\';
+    }
+
+    for (len = dir_len; *name; name++) {
+        if (len >= FS_PATH_MAX - 1) {
+            return EFI_BUFFER_TOO_SMALL;
+        }
+        path[len++] = *name;
+    }
+    path[len] = 0;
+
+    return EFI_SUCCESS;
+}
+
+static EFI_STATUS fs_open_image_file(EFI_HANDLE image_handle, const CHAR16 *name,
+                                     UINT64 mode, EFI_FILE_PROTOCOL **file)
+{
+    EFI_GUID LoadedImageGuid = EFI_LOADED_IMAGE_PROTOCOL_GUID;
+    EFI_GUID SimpleFsGuid = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
+    EFI_LOADED_IMAGE_PROTOCOL *loaded_image;
+    EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *fs;
+    EFI_FILE_PROTOCOL *root;
+    CHAR16 path[FS_PATH_MAX];
+    EFI_STATUS status;
+
+    status = gBS->HandleProtocol(image_handle, &LoadedImageGuid, (void **)&loaded_image);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    status = fs_image_path(loaded_image, name, path);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    status = gBS->HandleProtocol(loaded_image->DeviceHandle, &SimpleFsGuid, (void **)&fs);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    status = fs->OpenVolume(fs, &root);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    status = root->Open(root, file, path, mode, 0);
+    root->Close(root);
+
+    return status;
+}
+
+EFI_STATUS fs_image_file_size(EFI_HANDLE image_handle, const CHAR16 *name,
+                              UINT64 *size)
+{
+    EFI_GUID FileInfoGuid = EFI_FILE_INFO_ID;
+    EFI_FILE_PROTOCOL *file;
+    EFI_FILE_INFO *info;
+    UINTN info_size = 0;
+    EFI_STATUS status;
+
+    status = fs_open_image_file(image_handle, name, EFI_FILE_MODE_READ, &file);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    /* The name makes the size of the info variable */
+    status = file->GetInfo(file, &FileInfoGuid, &info_size, NULL);
+    if (status == EFI_BUFFER_TOO_SMALL) {
+        status = gBS->AllocatePool(EfiLoaderData, info_size, (void **)&info);
+        if (!EFI_ERROR(status)) {
+            status = file->GetInfo(file, &FileInfoGuid, &info_size, info);
+            if (!EFI_ERROR(status)) {
+                *size = info->FileSize;
+            }
+            gBS->FreePool(info);
+        }
+    }
+    file->Close(file);
+
+    return status;
+}
+
+/*
+ * Read at most *size bytes, *size is updated with the amount actually read.
+ */
+EFI_STATUS fs_read_image_file(EFI_HANDLE image_handle, const CHAR16 *name,
+                              void *buf, UINTN *size)
+{
+    EFI_FILE_PROTOCOL *file;
+    EFI_STATUS status;
+
+    status = fs_open_image_file(image_handle, name, EFI_FILE_MODE_READ, &file);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    status = file->Read(file, size, buf);
+    file->Close(file);
+
+    return status;
+}
+
+EFI_STATUS fs_write_image_file(EFI_HANDLE image_handle, const CHAR16 *name,
+                               const void *buf, UINTN size)
+{
+    EFI_FILE_PROTOCOL *file;
+    EFI_STATUS status;
+
+    status = fs_open_image_file(image_handle, name,
+                                EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+                                &file);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    status = file->Write(file, &size, (void *)buf);
+    if (!EFI_ERROR(status)) {
+        status = file->Flush(file);
+    }
+    file->Close(file);
+
+    return status;
+}
@@ -0,0 +1,13 @@
+#ifndef FS_H
+#define FS_H
+
+#include <efi.h>
+
+EFI_STATUS fs_read_image_file(EFI_HANDLE image_handle, const CHAR16 *name,
+                              void *buf, UINTN *size);
+EFI_STATUS fs_image_file_size(EFI_HANDLE image_handle, const CHAR16 *name,
+                              UINT64 *size);
+EFI_STATUS fs_write_image_file(EFI_HANDLE image_handle, const CHAR16 *name,
+                               const void *buf, UINTN size);
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * IDE drive information for the CSM boot table.
+ *
+ * Each legacy IDE controller takes two HddInfo slots, primary then
+ * secondary channel, with the resources read from config space. Drives
+ * UEFI already found on them get their IDENTIFY data from DiskInfo, so a
+ * channel without a drive flag is known to be empty.
+ */
+
+#include <efi.h>
+#include <csmwrap.h>
+#include <io.h>
+#include <hddinfo.h>
+#include <timestamp.h>
+#include <edk2/DiskInfo.h>
+
+#define HDD_CONTROLLER_MAX  (MAX_IDE_CONTROLLER / 2)
+
+/* IDENTIFY word 0 of an ATAPI device, and its peripheral type */
+#define IDENTIFY_ATAPI_MASK     0xc000
+#define IDENTIFY_ATAPI          0x8000
+#define IDENTIFY_TYPE(w)        (((w) >> 8) & 0x1f)
+#define IDENTIFY_TYPE_CDROM     0x05
+
+struct hdd_controller {
+    const struct pci_device *dev;
+    unsigned int drives;
+    uint64_t tsc;
+};
+
+static void hddinfo_fill_channels(HDD_INFO *info, const struct pci_device *dev)
+{
+    uint8_t prog_if = dev->class_code & 0xff;
+    uint8_t irq = dev->int_line;
+    uint16_t bus_master = (dev->bars[4] & 1) ? dev->bars[4] & 0xfffc : 0;
+
+    for (int ch = 0; ch < 2; ch++) {
+        info[ch].Status = ch ? HDD_SECONDARY : HDD_PRIMARY;
+        info[ch].Bus = dev->bus;
+        info[ch].Device = PCI_SLOT(dev->devfn);
+        info[ch].Function = PCI_FUNC(dev->devfn);
+
+        /* Programming interface bits 0 and 2 select native mode per channel */
+        if (prog_if & (1 << (ch * 2))) {
+            info[ch].CommandBaseAddress = dev->bars[ch * 2] & 0xfffc;
+            info[ch].ControlBaseAddress = (dev->bars[ch * 2 + 1] & 0xfffc) + 2;
+            info[ch].HddIrq = irq;
+        } else {
+            info[ch].CommandBaseAddress = ch ? 0x170 : 0x1f0;
+            info[ch].ControlBaseAddress = ch ? 0x376 : 0x3f6;
+            info[ch].HddIrq = ch ? 15 : 14;
+        }
+
+        info[ch].BusMasterAddress = bus_master ? bus_master + ch * 8 : 0;
+    }
+}
+
+static uint16_t hddinfo_drive_status(const ATAPI_IDENTIFY *id, uint32_t device)
+{
+    if ((id->Raw[0] & IDENTIFY_ATAPI_MASK) != IDENTIFY_ATAPI) {
+        return device ? HDD_SLAVE_IDE : HDD_MASTER_IDE;
+    }
+    if (IDENTIFY_TYPE(id->Raw[0]) == IDENTIFY_TYPE_CDROM) {
+        return device ? HDD_SLAVE_ATAPI_CDROM : HDD_MASTER_ATAPI_CDROM;
+    }
+    return device ? HDD_SLAVE_ATAPI_ZIPDISK : HDD_MASTER_ATAPI_ZIPDISK;
+}
+
+void hddinfo_build(struct csmwrap_priv *priv)
+{
+    EFI_STATUS Status;
+    EFI_GUID DiskInfoGuid = EFI_DISK_INFO_PROTOCOL_GUID;
+    EFI_GUID IdeInterfaceGuid = EFI_DISK_INFO_IDE_INTERFACE_GUID;
+    EFI_HANDLE *HandleBuffer;
+    UINTN HandleCount;
+    HDD_INFO *info = priv->low_stub->boot_table.HddInfo;
+    struct hdd_controller ctrl[HDD_CONTROLLER_MAX];
+    struct timestamp_table *ts = timestamp_get_table();
+    unsigned int count = 0;
+    const struct pci_device *dev = NULL;
+
+    while ((dev = pci_find_class(&priv->pci, dev, PCI_CLASS_MASS_STORAGE,
+                                 PCI_CLASS_MASS_STORAGE_IDE)) != NULL) {
+        uint64_t start = rdtsc();
+
+        if (count == HDD_CONTROLLER_MAX) {
+            printf("HddInfo full, IDE %02x:%02x.%x left out\n",
+                   dev->bus, PCI_SLOT(dev->devfn), PCI_FUNC(dev->devfn));
+            break;
+        }
+
+        hddinfo_fill_channels(&info[count * 2], dev);
+        ctrl[count].dev = dev;
+        ctrl[count].drives = 0;
+        ctrl[count].tsc = rdtsc() - start;
+        count++;
+    }
+
+    if (count == 0) {
+        return;
+    }
+
+    Status = gBS->LocateHandleBuffer(ByProtocol, &DiskInfoGuid, NULL,
+                                     &HandleCount, &HandleBuffer);
+    if (EFI_ERROR(Status)) {
+        HandleCount = 0;
+        HandleBuffer = NULL;
+    }
+
+    for (UINTN i = 0; i < HandleCount; i++) {
+        EFI_DISK_INFO_PROTOCOL *DiskInfo;
+        uint64_t start = rdtsc();
+        uint32_t channel, device, size;
+        uint8_t bus, devfn;
+        unsigned int c;
+        HDD_INFO *slot;
+
+        if (gBS->HandleProtocol(HandleBuffer[i], &DiskInfoGuid, (VOID **)&DiskInfo) != EFI_SUCCESS ||
+            efi_guidcmp(DiskInfo->Interface, IdeInterfaceGuid) != 0) {
+            continue;
+        }
+
+        if (DiskInfo->WhichIde(DiskInfo, &channel, &device) != EFI_SUCCESS ||
+            channel > 1 || device > 1) {
+            continue;
+        }
+
+        if (pci_handle_location(HandleBuffer[i], &bus, &devfn) != EFI_SUCCESS) {
+            continue;
+        }
+
+        for (c = 0; c < count; c++) {
+            if (ctrl[c].dev->bus == bus && ctrl[c].dev->devfn == devfn) {
+                break;
+            }
+        }
+        if (c == count) {
+            continue;
+        }
+
+        slot = &info[c * 2 + channel];
+        size = sizeof(slot->IdentifyDrive[device]);
+        if (DiskInfo->Identify(DiskInfo, &slot->IdentifyDrive[device], &size) != EFI_SUCCESS) {
+            continue;
+        }
+
+        slot->Status |= hddinfo_drive_status(&slot->IdentifyDrive[device], device);
+        ctrl[c].drives++;
+        ctrl[c].tsc += rdtsc() - start;
+    }
+
+    if (HandleBuffer) {
+        gBS->FreePool(HandleBuffer);
+    }
+
+    /*
+     * Only the prefill's own cost is measured here. Whatever the CSM saves
+     * by not probing the channels itself is not, it has no timestamps
+     * inside PrepareToBoot to tell it apart from the rest of the call.
+     */
+    for (unsigned int c = 0; c < count; c++) {
+        uint64_t us = (ts && ts->tick_freq_mhz) ? ctrl[c].tsc / ts->tick_freq_mhz : 0;
+
+        printf("HddInfo IDE %02x:%02x.%x: %u drives, %u empty channels, prefill took %lu us\n",
+               ctrl[c].dev->bus, PCI_SLOT(ctrl[c].dev->devfn), PCI_FUNC(ctrl[c].dev->devfn),
+               ctrl[c].drives,
+               !(info[c * 2].Status & ~HDD_PRIMARY) + !(info[c * 2 + 1].Status & ~HDD_SECONDARY),
+               (unsigned long)us);
+    }
+}
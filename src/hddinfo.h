@@ -0,0 +1,9 @@
+#ifndef HDDINFO_H
+#define HDDINFO_H
+
+struct csmwrap_priv;
+
+/* Fills HddInfo of the boot table for IDE controllers, needs boot services */
+void hddinfo_build(struct csmwrap_priv *priv);
+
+#endif
@@ -138,11 +138,11 @@ test_pit:
     return 0;
 }
 
-int apply_intel_platform_workarounds(void)
+int apply_intel_platform_workarounds(struct csmwrap_priv *priv)
 {
     uint16_t vendor_id;
 
-    vendor_id = pciConfigReadWord(0, 0, 0, 0x0);
+    vendor_id = pci_host_bridge_id(&priv->pci) & 0xffff;
 
     if (vendor_id != 0x8086) {
         return 0;
@@ -202,6 +202,27 @@ outsl(int port, const void *addr, int cnt)
 #define PCI_CONFIG_ADDRESS 0xcf8
 #define PCI_CONFIG_DATA 0xcfc
 
+/* ECAM window for PCI segment 0, from MCFG by acpi_init(). 0 if none. */
+extern uintptr_t pci_ecam_base;
+extern uint8_t pci_ecam_bus_start;
+extern uint8_t pci_ecam_bus_end;
+
+/* Port I/O only reaches the first 256 bytes of config space */
+#define PCI_CONFIG_PIO_SIZE 0x100
+
+/* Returns the MMIO address of the register, or NULL to use port I/O */
+static inline void *pciEcamAddress(unsigned int bus, unsigned int slot,
+                                   unsigned int function, unsigned int offset)
+{
+    if (!pci_ecam_base || bus < pci_ecam_bus_start || bus > pci_ecam_bus_end) {
+        return NULL;
+    }
+
+    return (void *)(pci_ecam_base + ((uintptr_t)(bus & 0xff) << 20)
+                    + ((slot & 0x1f) << 15) + ((function & 0x7) << 12)
+                    + (offset & 0xfff));
+}
+
 static inline void pciSetAddress(unsigned int bus, unsigned int slot,
                    unsigned int function, unsigned int offset)
 {
@@ -226,6 +247,15 @@ static inline void pciSetAddress(unsigned int bus, unsigned int slot,
 static inline uint8_t pciConfigReadByte(unsigned int bus, unsigned int slot,
                                 unsigned int function, unsigned int offset)
 {
+    void *ecam = pciEcamAddress(bus, slot, function, offset);
+
+    if (ecam) {
+        return readb(ecam);
+    }
+    if (offset >= PCI_CONFIG_PIO_SIZE) {
+        return 0xff;
+    }
+
     pciSetAddress(bus, slot, function, offset);
     /* The PCI registers are little endian,
      * so the last byte of DWORD is read
@@ -236,6 +266,15 @@ static inline uint8_t pciConfigReadByte(unsigned int bus, unsigned int slot,
 static inline uint16_t pciConfigReadWord(unsigned int bus, unsigned int slot,
                                unsigned int function, unsigned int offset)
 {
+    void *ecam = pciEcamAddress(bus, slot, function, offset);
+
+    if (ecam) {
+        return readw(ecam);
+    }
+    if (offset >= PCI_CONFIG_PIO_SIZE) {
+        return 0xffff;
+    }
+
     pciSetAddress(bus, slot, function, offset);
     /* The PCI registers are little endian,
      * so the last word of DWORD is read
@@ -246,6 +285,15 @@ static inline uint16_t pciConfigReadWord(unsigned int bus, unsigned int slot,
 static inline uint32_t pciConfigReadDWord(unsigned int bus, unsigned int slot,
                                  unsigned int function, unsigned int offset)
 {
+    void *ecam = pciEcamAddress(bus, slot, function, offset);
+
+    if (ecam) {
+        return readl(ecam);
+    }
+    if (offset >= PCI_CONFIG_PIO_SIZE) {
+        return 0xffffffff;
+    }
+
     pciSetAddress(bus, slot, function, offset);
     return (inl(PCI_CONFIG_DATA));
 }
@@ -254,6 +302,16 @@ static inline void pciConfigWriteByte(unsigned int bus, unsigned int slot,
                         unsigned int function, unsigned int offset,
                         uint8_t data)
 {
+    void *ecam = pciEcamAddress(bus, slot, function, offset);
+
+    if (ecam) {
+        writeb(ecam, data);
+        return;
+    }
+    if (offset >= PCI_CONFIG_PIO_SIZE) {
+        return;
+    }
+
     pciSetAddress(bus, slot, function, offset);
     /* The PCI registers are little endian,
      * so the last byte of DWORD is written
@@ -265,6 +323,16 @@ static inline void pciConfigWriteWord(unsigned int bus, unsigned int slot,
                         unsigned int function, unsigned int offset,
                         uint16_t data)
 {
+    void *ecam = pciEcamAddress(bus, slot, function, offset);
+
+    if (ecam) {
+        writew(ecam, data);
+        return;
+    }
+    if (offset >= PCI_CONFIG_PIO_SIZE) {
+        return;
+    }
+
     pciSetAddress(bus, slot, function, offset);
     /* The PCI registers are little endian,
      * so the last word of DWORD is written
@@ -276,6 +344,16 @@ static inline void pciConfigWriteDWord(unsigned int bus, unsigned int slot,
                          unsigned int function, unsigned int offset,
                          uint32_t data)
 {
+    void *ecam = pciEcamAddress(bus, slot, function, offset);
+
+    if (ecam) {
+        writel(ecam, data);
+        return;
+    }
+    if (offset >= PCI_CONFIG_PIO_SIZE) {
+        return;
+    }
+
     pciSetAddress(bus, slot, function, offset);
     outl(PCI_CONFIG_DATA, data);
 }
@@ -296,6 +374,56 @@ static inline uint64_t rdtsc(void) {
     return ((uint64_t)edx << 32) | eax;
 }
 
+static inline uintptr_t irq_save(void) {
+    uintptr_t flags;
+    asm volatile ("pushf\n\tpop %0\n\tcli" : "=r" (flags) :: "memory");
+    return flags;
+}
+
+static inline void irq_restore(uintptr_t flags) {
+    asm volatile ("push %0\n\tpopf" :: "r" (flags) : "memory", "cc");
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax,
+                         uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    asm volatile ("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                          : "a"(leaf), "c"(subleaf));
+}
+
+static inline uintptr_t read_cr0(void) {
+    uintptr_t val;
+    asm volatile ("mov %%cr0, %0" : "=r" (val));
+    return val;
+}
+
+static inline void write_cr0(uintptr_t val) {
+    asm volatile ("mov %0, %%cr0" :: "r" (val) : "memory");
+}
+
+static inline uintptr_t read_cr3(void) {
+    uintptr_t val;
+    asm volatile ("mov %%cr3, %0" : "=r" (val));
+    return val;
+}
+
+static inline void write_cr3(uintptr_t val) {
+    asm volatile ("mov %0, %%cr3" :: "r" (val) : "memory");
+}
+
+static inline uintptr_t read_cr4(void) {
+    uintptr_t val;
+    asm volatile ("mov %%cr4, %0" : "=r" (val));
+    return val;
+}
+
+static inline void write_cr4(uintptr_t val) {
+    asm volatile ("mov %0, %%cr4" :: "r" (val) : "memory");
+}
+
+static inline void wbinvd(void) {
+    asm volatile ("wbinvd" ::: "memory");
+}
+
 static inline void delay(uint64_t cycles) {
     uint64_t next_stop = rdtsc() + cycles;
 
@@ -1,18 +1,68 @@
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <libc.h>
 
+/*
+ * We are built without SSE, so bulk operations go through x86 string
+ * instructions. If the CPU advertises ERMS (Enhanced REP MOVSB/STOSB),
+ * byte granular rep is the fastest path and takes care of the tail too.
+ * Otherwise we move native words and finish the tail byte by byte.
+ */
+#ifdef __x86_64__
+#define REP_MOVS_LONG   "rep movsq"
+#define REP_STOS_LONG   "rep stosq"
+#else
+#define REP_MOVS_LONG   "rep movsl"
+#define REP_STOS_LONG   "rep stosl"
+#endif
+
+#define CPUID_7_0_EBX_ERMS  (1 << 9)
+
+static int erms_supported = -1;
+
+static bool cpu_has_erms(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    if (erms_supported >= 0) {
+        return erms_supported;
+    }
+
+    asm volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0), "c"(0));
+    if (eax < 7) {
+        erms_supported = 0;
+        return false;
+    }
+
+    asm volatile ("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(7), "c"(0));
+    erms_supported = !!(ebx & CPUID_7_0_EBX_ERMS);
+
+    return erms_supported;
+}
+
 #ifdef memcpy
 #  undef memcpy
 #endif
 void *memcpy(void *restrict dest, const void *restrict src, size_t n) {
-    uint8_t *restrict pdest = (uint8_t *restrict)dest;
-    const uint8_t *restrict psrc = (const uint8_t *restrict)src;
+    void *d = dest;
+    const void *s = src;
 
-    for (size_t i = 0; i < n; i++) {
-        pdest[i] = psrc[i];
+    if (!cpu_has_erms() && n >= 2 * sizeof(unsigned long)) {
+        /* Align destination, then move words */
+        size_t head = -(uintptr_t)d & (sizeof(unsigned long) - 1);
+        size_t words;
+
+        n -= head;
+        words = n / sizeof(unsigned long);
+        n &= sizeof(unsigned long) - 1;
+
+        asm volatile ("rep movsb" : "+D"(d), "+S"(s), "+c"(head) :: "memory");
+        asm volatile (REP_MOVS_LONG : "+D"(d), "+S"(s), "+c"(words) :: "memory");
     }
 
+    asm volatile ("rep movsb" : "+D"(d), "+S"(s), "+c"(n) :: "memory");
+
     return dest;
 }
 
@@ -20,12 +70,23 @@ void *memcpy(void *restrict dest, const void *restrict src, size_t n) {
 #  undef memset
 #endif
 void *memset(void *s, int c, size_t n) {
-    uint8_t *p = (uint8_t *)s;
+    void *p = s;
 
-    for (size_t i = 0; i < n; i++) {
-        p[i] = (uint8_t)c;
+    if (!cpu_has_erms() && n >= 2 * sizeof(unsigned long)) {
+        unsigned long pattern = (uint8_t)c * (~0UL / 0xff);
+        size_t head = -(uintptr_t)p & (sizeof(unsigned long) - 1);
+        size_t words;
+
+        n -= head;
+        words = n / sizeof(unsigned long);
+        n &= sizeof(unsigned long) - 1;
+
+        asm volatile ("rep stosb" : "+D"(p), "+c"(head) : "a"(pattern) : "memory");
+        asm volatile (REP_STOS_LONG : "+D"(p), "+c"(words) : "a"(pattern) : "memory");
     }
 
+    asm volatile ("rep stosb" : "+D"(p), "+c"(n) : "a"(c) : "memory");
+
     return s;
 }
 
@@ -36,14 +97,29 @@ void *memmove(void *dest, const void *src, size_t n) {
     uint8_t *pdest = (uint8_t *)dest;
     const uint8_t *psrc = (const uint8_t *)src;
 
-    if (src > dest) {
-        for (size_t i = 0; i < n; i++) {
-            pdest[i] = psrc[i];
-        }
+    if (src > dest || psrc + n <= pdest) {
+        /* Forward copy is safe */
+        return memcpy(dest, src, n);
     } else if (src < dest) {
-        for (size_t i = n; i > 0; i--) {
-            pdest[i-1] = psrc[i-1];
-        }
+        /*
+         * Overlapping with dest above src, copy backwards: the
+         * unaligned tail bytes first, then whole words.
+         */
+        void *d = pdest + n - 1;
+        const void *s = psrc + n - 1;
+        size_t tail = n & (sizeof(unsigned long) - 1);
+        size_t words = n / sizeof(unsigned long);
+
+        asm volatile ("std\n\t"
+                      "rep movsb\n\t"
+                      "sub %[adj], %0\n\t"
+                      "sub %[adj], %1\n\t"
+                      "mov %[words], %2\n\t"
+                      REP_MOVS_LONG "\n\t"
+                      "cld"
+                      : "+D"(d), "+S"(s), "+c"(tail)
+                      : [adj] "i"(sizeof(unsigned long) - 1), [words] "r"(words)
+                      : "memory", "cc");
     }
 
     return dest;
@@ -0,0 +1,153 @@
+#include <efi.h>
+#include <csmwrap.h>
+#include <io.h>
+#include <mp.h>
+#include <timestamp.h>
+#include <edk2/MpService.h>
+
+static EFI_GUID gEfiMpServiceProtocolGuid = EFI_MP_SERVICES_PROTOCOL_GUID;
+
+#define MSR_IA32_APIC_BASE          0x1B
+#define APIC_BASE_BSP               (1 << 8)
+#define APIC_BASE_EXTD              (1 << 10)
+#define APIC_BASE_EN                (1 << 11)
+#define APIC_BASE_ADDR_MASK         0xFFFFFFFFFF000ull
+
+#define XAPIC_ICR_LOW               0x300
+#define XAPIC_ICR_HIGH              0x310
+#define MSR_X2APIC_ICR              0x830
+
+#define ICR_DELIVERY_INIT           (5 << 8)
+#define ICR_DELIVERY_PENDING        (1 << 12)
+#define ICR_LEVEL_ASSERT            (1 << 14)
+#define ICR_TRIGGER_LEVEL           (1 << 15)
+#define ICR_ALL_EXCLUDING_SELF      (3 << 18)
+
+/* Generous, an AP that is still busy after this is not coming back */
+#define MP_AP_TIMEOUT_US    1000000
+/* Time the APs get to settle after INIT, as the SDM's MP init sequence */
+#define MP_INIT_DELAY_US    10000
+/* TSC rate to assume if it was never calibrated, too fast only waits longer */
+#define MP_FALLBACK_MHZ     5000
+
+struct mp_call {
+    mp_proc_t proc;
+    void *arg;
+};
+
+static EFI_MP_SERVICES_PROTOCOL *mp_services;
+static bool mp_services_probed;
+
+static VOID EFIAPI mp_ap_entry(VOID *buffer)
+{
+    struct mp_call *call = buffer;
+
+    call->proc(call->arg);
+}
+
+static EFI_MP_SERVICES_PROTOCOL *mp_get_services(void)
+{
+    EFI_STATUS status;
+
+    if (mp_services_probed) {
+        return mp_services;
+    }
+
+    mp_services_probed = true;
+    status = gBS->LocateProtocol(&gEfiMpServiceProtocolGuid, NULL, (void **)&mp_services);
+    if (EFI_ERROR(status)) {
+        printf("MP Services Protocol not found, running on the BSP only\n");
+        mp_services = NULL;
+    }
+
+    return mp_services;
+}
+
+int mp_run_on_all_cpus(mp_proc_t proc, void *arg)
+{
+    EFI_MP_SERVICES_PROTOCOL *mp = mp_get_services();
+    struct mp_call call = { .proc = proc, .arg = arg };
+    UINTN cpus = 1, enabled = 1;
+    EFI_STATUS status;
+
+    proc(arg);
+
+    if (!mp) {
+        return 1;
+    }
+
+    status = mp->GetNumberOfProcessors(mp, &cpus, &enabled);
+    if (EFI_ERROR(status) || enabled < 2) {
+        return 1;
+    }
+
+    status = mp->StartupAllAPs(mp, mp_ap_entry, FALSE, NULL, MP_AP_TIMEOUT_US, &call, NULL);
+    if (EFI_ERROR(status)) {
+        printf("StartupAllAPs failed: %lx\n", (unsigned long)status);
+        return 1;
+    }
+
+    return (int)enabled;
+}
+
+uint32_t mp_apic_id(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0xB) {
+        cpuid(0xB, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx) {
+            return edx;
+        }
+    }
+
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    return ebx >> 24;
+}
+
+static void xapic_send_ipi(void *apic, uint32_t icr)
+{
+    writel(apic + XAPIC_ICR_HIGH, 0);
+    writel(apic + XAPIC_ICR_LOW, icr);
+
+    while (readl(apic + XAPIC_ICR_LOW) & ICR_DELIVERY_PENDING) {
+        asm volatile ("pause");
+    }
+}
+
+/*
+ * INIT leaves the APs halted in wait-for-SIPI, off the memory bus and out
+ * of any firmware code or page tables the legacy OS is about to reuse. That
+ * is also the state the OS expects before its own INIT-SIPI-SIPI.
+ *
+ * x2APIC has no level de-assert INIT, the assert alone does it there.
+ */
+int mp_park_aps(void)
+{
+    struct timestamp_table *ts = timestamp_get_table();
+    uint64_t mhz = (ts && ts->tick_freq_mhz) ? ts->tick_freq_mhz : MP_FALLBACK_MHZ;
+    uint64_t apic_base = rdmsr(MSR_IA32_APIC_BASE);
+    uint32_t init_assert = ICR_ALL_EXCLUDING_SELF | ICR_TRIGGER_LEVEL |
+                           ICR_LEVEL_ASSERT | ICR_DELIVERY_INIT;
+    uint32_t init_deassert = ICR_ALL_EXCLUDING_SELF | ICR_TRIGGER_LEVEL |
+                             ICR_DELIVERY_INIT;
+
+    if (!(apic_base & APIC_BASE_EN) || !(apic_base & APIC_BASE_BSP)) {
+        return -1;
+    }
+
+    if (apic_base & APIC_BASE_EXTD) {
+        wrmsr(MSR_X2APIC_ICR, init_assert);
+    } else {
+        void *apic = (void *)(uintptr_t)(apic_base & APIC_BASE_ADDR_MASK);
+
+        xapic_send_ipi(apic, init_assert);
+        xapic_send_ipi(apic, init_deassert);
+    }
+
+    /* Boot services are gone, no Stall() here */
+    delay(MP_INIT_DELAY_US * mhz);
+
+    return 0;
+}
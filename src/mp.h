@@ -0,0 +1,23 @@
+#ifndef MP_H
+#define MP_H
+
+#include <stdint.h>
+
+typedef void (*mp_proc_t)(void *arg);
+
+/*
+ * Runs proc on the BSP, then on every enabled AP at once, and returns the
+ * number of CPUs it ran on. Needs boot services, proc must not use them.
+ */
+int mp_run_on_all_cpus(mp_proc_t proc, void *arg);
+
+/* Local APIC ID of the calling CPU, x2APIC wide when available */
+uint32_t mp_apic_id(void);
+
+/*
+ * Puts every AP back into wait-for-SIPI with an INIT IPI. Only valid after
+ * ExitBootServices, when nothing in UEFI expects the APs to respond.
+ */
+int mp_park_aps(void);
+
+#endif
@@ -0,0 +1,406 @@
+#include <efi.h>
+#include <csmwrap.h>
+#include <io.h>
+#include <mp.h>
+#include <mtrr.h>
+
+#define MSR_MTRR_CAP                0xFE
+#define MTRR_CAP_VCNT_MASK          0xFF
+#define MTRR_CAP_FIX                (1 << 8)
+#define MTRR_CAP_WC                 (1 << 10)
+#define MSR_MTRR_PHYS_BASE(n)       (0x200 + 2 * (n))
+#define MSR_MTRR_PHYS_MASK(n)       (0x201 + 2 * (n))
+#define MTRR_PHYS_MASK_VALID        (1 << 11)
+#define MSR_MTRR_DEF_TYPE           0x2FF
+#define MTRR_DEF_TYPE_FE            (1 << 10)
+#define MTRR_DEF_TYPE_E             (1 << 11)
+
+#define MSR_MTRR_FIX64K_00000       0x250
+#define MSR_MTRR_FIX16K_80000       0x258
+#define MSR_MTRR_FIX16K_A0000       0x259
+#define MSR_MTRR_FIX4K_C0000        0x268
+#define MSR_MTRR_FIX4K_F8000        0x26F
+
+/* One memory type per byte, each byte covering a sub-range */
+#define MTRR_FIX_ALL(type)          (0x0101010101010101ull * (type))
+
+#define CPUID_1_EDX_MTRR            (1 << 12)
+
+#define CR0_NW                      (1ul << 29)
+#define CR0_CD                      (1ul << 30)
+#define CR4_PGE                     (1ul << 7)
+
+#define MTRR_MIN_SIZE               0x1000ull
+
+void mtrr_update_add_masked(struct mtrr_update *update, uint32_t index,
+                            uint64_t value, uint64_t verify_mask)
+{
+    if (update->count >= MTRR_UPDATE_MAX) {
+        printf("MTRR update overflow, dropping MSR %x\n", index);
+        return;
+    }
+
+    update->msr[update->count].index = index;
+    update->msr[update->count].value = value;
+    update->msr[update->count].verify_mask = verify_mask;
+    update->count++;
+}
+
+void mtrr_update_add(struct mtrr_update *update, uint32_t index, uint64_t value)
+{
+    mtrr_update_add_masked(update, index, value, ~0ull);
+}
+
+/*
+ * Runs on every CPU. Follows the SDM sequence for changing MTRRs: caches
+ * off and flushed, TLBs flushed, MTRRs off while they are rewritten.
+ */
+static void mtrr_update_cpu(void *arg)
+{
+    struct mtrr_update *update = arg;
+    uintptr_t flags = irq_save();
+    uintptr_t cr0 = read_cr0();
+    uintptr_t cr4 = read_cr4();
+    uint64_t def_type;
+
+    write_cr0((cr0 | CR0_CD) & ~CR0_NW);
+    wbinvd();
+    if (cr4 & CR4_PGE) {
+        write_cr4(cr4 & ~CR4_PGE);
+    } else {
+        write_cr3(read_cr3());
+    }
+
+    def_type = rdmsr(MSR_MTRR_DEF_TYPE);
+    wrmsr(MSR_MTRR_DEF_TYPE, def_type & ~(MTRR_DEF_TYPE_E | MTRR_DEF_TYPE_FE));
+
+    for (unsigned int i = 0; i < update->count; i++) {
+        wrmsr(update->msr[i].index, update->msr[i].value);
+    }
+
+    wbinvd();
+    if (update->set_def_type) {
+        def_type = update->def_type;
+    }
+    wrmsr(MSR_MTRR_DEF_TYPE, def_type);
+
+    write_cr0(cr0);
+    if (cr4 & CR4_PGE) {
+        write_cr4(cr4);
+    } else {
+        write_cr3(read_cr3());
+    }
+    irq_restore(flags);
+}
+
+void mtrr_update_this_cpu(struct mtrr_update *update)
+{
+    mtrr_update_cpu(update);
+}
+
+/* Mismatches kept for the report, the rest are only counted */
+#define MTRR_VERIFY_REPORT_MAX      8
+
+struct mtrr_verify {
+    struct mtrr_update *update;
+    uint32_t cpus;
+    uint32_t bad_cpus;
+    uint32_t bad_count;
+    struct {
+        uint32_t apic_id;
+        uint32_t index;
+        uint64_t value;
+        uint64_t expected;
+    } bad[MTRR_VERIFY_REPORT_MAX];
+};
+
+static void mtrr_verify_report(struct mtrr_verify *verify, uint32_t index,
+                               uint64_t value, uint64_t expected)
+{
+    uint32_t slot = __atomic_fetch_add(&verify->bad_count, 1, __ATOMIC_RELAXED);
+
+    if (slot < MTRR_VERIFY_REPORT_MAX) {
+        verify->bad[slot].apic_id = mp_apic_id();
+        verify->bad[slot].index = index;
+        verify->bad[slot].value = value;
+        verify->bad[slot].expected = expected;
+    }
+}
+
+/* Runs on every CPU, checks the final value of each MSR in the update */
+static void mtrr_verify_cpu(void *arg)
+{
+    struct mtrr_verify *verify = arg;
+    struct mtrr_update *update = verify->update;
+    bool bad = false;
+
+    for (unsigned int i = 0; i < update->count; i++) {
+        unsigned int j;
+
+        for (j = i + 1; j < update->count; j++) {
+            if (update->msr[j].index == update->msr[i].index) {
+                break;
+            }
+        }
+        if (j < update->count) {
+            continue;
+        }
+
+        uint64_t value = rdmsr(update->msr[i].index);
+        if ((value ^ update->msr[i].value) & update->msr[i].verify_mask) {
+            mtrr_verify_report(verify, update->msr[i].index, value, update->msr[i].value);
+            bad = true;
+        }
+    }
+
+    if (update->set_def_type) {
+        uint64_t value = rdmsr(MSR_MTRR_DEF_TYPE);
+        if (value != update->def_type) {
+            mtrr_verify_report(verify, MSR_MTRR_DEF_TYPE, value, update->def_type);
+            bad = true;
+        }
+    }
+
+    __atomic_fetch_add(&verify->cpus, 1, __ATOMIC_RELAXED);
+    if (bad) {
+        __atomic_fetch_add(&verify->bad_cpus, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Replays the update on every CPU, then reads it back everywhere and
+ * reports the CPUs that don't agree. Returns the number of CPUs updated.
+ */
+int mtrr_update_all_cpus(struct mtrr_update *update)
+{
+    struct mtrr_verify verify = { .update = update };
+    int cpus;
+
+    cpus = mp_run_on_all_cpus(mtrr_update_cpu, update);
+    mp_run_on_all_cpus(mtrr_verify_cpu, &verify);
+
+    if (verify.bad_cpus == 0) {
+        if (DEBUG_PRINT_LEVEL & DEBUG_VERBOSE) {
+            printf("MTRR readback: %u CPUs match\n", verify.cpus);
+        }
+        return cpus;
+    }
+
+    printf("MTRR readback: %u of %u CPUs mismatch\n", verify.bad_cpus, verify.cpus);
+    for (uint32_t i = 0; i < verify.bad_count && i < MTRR_VERIFY_REPORT_MAX; i++) {
+        printf("  APIC %u MSR %x: %llx, expected %llx\n",
+               verify.bad[i].apic_id, verify.bad[i].index,
+               (unsigned long long)verify.bad[i].value,
+               (unsigned long long)verify.bad[i].expected);
+    }
+
+    return cpus;
+}
+
+static uint64_t phys_addr_mask(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    unsigned int bits = 36;
+
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax >= 0x80000008) {
+        cpuid(0x80000008, 0, &eax, &ebx, &ecx, &edx);
+        bits = eax & 0xFF;
+    }
+
+    return (1ull << bits) - 1;
+}
+
+/*
+ * Marks [base, base + size) write-combining with free variable MTRRs, on
+ * every CPU. The range is grown to a power of two when that keeps it to a
+ * single MTRR. Nothing is changed if an existing MTRR overlaps the range,
+ * as UC would win over WC and other combinations are undefined.
+ */
+int mtrr_set_wc(uint64_t base, uint64_t size)
+{
+    uint32_t eax, ebx, ecx, edx;
+    uint64_t cap, phys_mask, end, pow2;
+    unsigned int vcnt, free_count = 0;
+    unsigned int free_slots[MTRR_CAP_VCNT_MASK + 1];
+    struct mtrr_update update = { 0 };
+
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_1_EDX_MTRR)) {
+        return -1;
+    }
+
+    cap = rdmsr(MSR_MTRR_CAP);
+    if (!(cap & MTRR_CAP_WC)) {
+        printf("MTRR: write-combining not supported\n");
+        return -1;
+    }
+
+    if (size == 0) {
+        return -1;
+    }
+
+    phys_mask = phys_addr_mask();
+    vcnt = cap & MTRR_CAP_VCNT_MASK;
+
+    pow2 = MTRR_MIN_SIZE;
+    while (pow2 < size) {
+        pow2 <<= 1;
+    }
+    if (IS_ALIGNED(base, pow2)) {
+        end = base + pow2;
+    } else {
+        end = ALIGN_UP(base + size, MTRR_MIN_SIZE);
+    }
+    base = ALIGN_DOWN(base, MTRR_MIN_SIZE);
+
+    for (unsigned int i = 0; i < vcnt; i++) {
+        uint64_t mtrr_mask = rdmsr(MSR_MTRR_PHYS_MASK(i));
+        uint64_t mtrr_base = rdmsr(MSR_MTRR_PHYS_BASE(i));
+        uint64_t start, len;
+        uint8_t type = mtrr_base & 0xFF;
+
+        if (!(mtrr_mask & MTRR_PHYS_MASK_VALID)) {
+            free_slots[free_count++] = i;
+            continue;
+        }
+
+        mtrr_mask &= phys_mask & ~(MTRR_MIN_SIZE - 1);
+        start = mtrr_base & mtrr_mask;
+        len = (~mtrr_mask & phys_mask) + 1;
+
+        if (start >= end || start + len <= base) {
+            continue;
+        }
+
+        if (type == MTRR_TYPE_WC && start <= base && start + len >= end) {
+            printf("MTRR: %llx-%llx already write-combining\n",
+                   (unsigned long long)base, (unsigned long long)(end - 1));
+            return 0;
+        }
+
+        printf("MTRR: %llx-%llx overlaps MTRR %u (type %u), leaving it alone\n",
+               (unsigned long long)base, (unsigned long long)(end - 1), i, type);
+        return -1;
+    }
+
+    /* Greedy power of two chunks, each aligned to its size */
+    for (uint64_t addr = base; addr < end; ) {
+        uint64_t chunk = addr ? (addr & -addr) : (1ull << 63);
+
+        while (chunk > end - addr) {
+            chunk >>= 1;
+        }
+
+        if (update.count / 2 >= free_count || update.count + 2 > MTRR_UPDATE_MAX) {
+            printf("MTRR: not enough free variable MTRRs for %llx-%llx\n",
+                   (unsigned long long)base, (unsigned long long)(end - 1));
+            return -1;
+        }
+
+        unsigned int slot = free_slots[update.count / 2];
+        mtrr_update_add(&update, MSR_MTRR_PHYS_BASE(slot), addr | MTRR_TYPE_WC);
+        mtrr_update_add(&update, MSR_MTRR_PHYS_MASK(slot),
+                        (~(chunk - 1) & phys_mask) | MTRR_PHYS_MASK_VALID);
+        addr += chunk;
+    }
+
+    int cpus = mtrr_update_all_cpus(&update);
+
+    printf("MTRR: %llx-%llx write-combining on %d CPUs, %u MTRRs\n",
+           (unsigned long long)base, (unsigned long long)(end - 1), cpus, update.count / 2);
+
+    return 0;
+}
+
+static bool cpu_is_intel(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    /* "GenuineIntel" */
+    return ebx == 0x756e6547 && edx == 0x49656e69 && ecx == 0x6c65746e;
+}
+
+/* Fixed MTRRs as the firmware left them, to compare against */
+static struct mtrr_update legacy_region_orig;
+static struct mtrr_update legacy_region_wb;
+
+/*
+ * Intel counterpart of unlock_amd_mtrr(): once PAM routes the BIOS shadow
+ * to DRAM, cache C0000-FFFFF as WB instead of whatever the firmware had
+ * for the flash behind it, keeping A0000-BFFFF UC for legacy VGA. Applied
+ * on every CPU. AMD fixed MTRRs carry extra RdDram/WrDram bits and are left
+ * to unlock_amd_mtrr().
+ */
+int mtrr_set_legacy_region_wb(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    uint64_t def_type;
+    struct mtrr_update *update = &legacy_region_wb;
+    struct mtrr_update *orig = &legacy_region_orig;
+
+    if (!cpu_is_intel()) {
+        return -1;
+    }
+
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_1_EDX_MTRR) || !(rdmsr(MSR_MTRR_CAP) & MTRR_CAP_FIX)) {
+        return -1;
+    }
+
+    def_type = rdmsr(MSR_MTRR_DEF_TYPE);
+    update->count = 0;
+    orig->count = 0;
+    orig->set_def_type = true;
+    orig->def_type = def_type;
+
+    /*
+     * With fixed MTRRs off the low 1MiB follows the variable ones, which
+     * we don't touch, so the conventional memory ranges have to be filled
+     * in before turning them on.
+     */
+    if (!(def_type & MTRR_DEF_TYPE_FE)) {
+        mtrr_update_add(update, MSR_MTRR_FIX64K_00000, MTRR_FIX_ALL(MTRR_TYPE_WB));
+        mtrr_update_add(update, MSR_MTRR_FIX16K_80000, MTRR_FIX_ALL(MTRR_TYPE_WB));
+        update->set_def_type = true;
+        update->def_type = def_type | MTRR_DEF_TYPE_FE;
+    }
+
+    mtrr_update_add(update, MSR_MTRR_FIX16K_A0000, MTRR_FIX_ALL(MTRR_TYPE_UC));
+    for (uint32_t msr = MSR_MTRR_FIX4K_C0000; msr <= MSR_MTRR_FIX4K_F8000; msr++) {
+        mtrr_update_add(update, msr, MTRR_FIX_ALL(MTRR_TYPE_WB));
+    }
+
+    for (unsigned int i = 0; i < update->count; i++) {
+        mtrr_update_add(orig, update->msr[i].index, rdmsr(update->msr[i].index));
+    }
+
+    int cpus = mtrr_update_all_cpus(update);
+
+    printf("MTRR: C0000-FFFFF write-back on %d CPUs\n", cpus);
+
+    return 0;
+}
+
+#ifdef CSMWRAP_BENCHMARK
+/*
+ * Runs bench with the fixed MTRRs the firmware had, then with the WB ones.
+ * Only touches the calling CPU, so it works after ExitBootServices.
+ */
+void bench_legacy_region_mtrr(void (*bench)(void))
+{
+    if (!legacy_region_wb.count) {
+        bench();
+        return;
+    }
+
+    printf("bench with firmware fixed MTRRs:\n");
+    mtrr_update_this_cpu(&legacy_region_orig);
+    bench();
+
+    printf("bench with WB BIOS shadow:\n");
+    mtrr_update_this_cpu(&legacy_region_wb);
+    bench();
+}
+#endif
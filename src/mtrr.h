@@ -0,0 +1,41 @@
+#ifndef MTRR_H
+#define MTRR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MTRR_TYPE_UC    0
+#define MTRR_TYPE_WC    1
+#define MTRR_TYPE_WT    4
+#define MTRR_TYPE_WP    5
+#define MTRR_TYPE_WB    6
+
+#define MTRR_UPDATE_MAX 32
+
+/* MSR writes done in order, with caches and MTRRs disabled */
+struct mtrr_update {
+    /* Replaces IA32_MTRR_DEF_TYPE once done, if set */
+    bool set_def_type;
+    uint64_t def_type;
+    unsigned int count;
+    struct {
+        uint32_t index;
+        uint64_t value;
+        /* Bits compared when reading back */
+        uint64_t verify_mask;
+    } msr[MTRR_UPDATE_MAX];
+};
+
+void mtrr_update_add(struct mtrr_update *update, uint32_t index, uint64_t value);
+void mtrr_update_add_masked(struct mtrr_update *update, uint32_t index,
+                            uint64_t value, uint64_t verify_mask);
+void mtrr_update_this_cpu(struct mtrr_update *update);
+int mtrr_update_all_cpus(struct mtrr_update *update);
+int mtrr_set_wc(uint64_t base, uint64_t size);
+int mtrr_set_legacy_region_wb(void);
+
+#ifdef CSMWRAP_BENCHMARK
+void bench_legacy_region_mtrr(void (*bench)(void));
+#endif
+
+#endif
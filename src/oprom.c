@@ -0,0 +1,183 @@
+/*
+ * PCI expansion ROM image selection.
+ *
+ * Kept free of boot services so it only depends on the ROM contents.
+ */
+
+#include <efi.h>
+#include <csmwrap.h>
+#include <oprom.h>
+
+EFI_STATUS
+GetPciLegacyRom (
+  IN     UINT16 Csm16Revision,
+  IN     UINT16 VendorId,
+  IN     UINT16 DeviceId,
+  IN OUT VOID   **Rom,
+  IN OUT UINTN  *ImageSize,
+  OUT    UINTN  *MaxRuntimeImageLength,   OPTIONAL
+  OUT    UINT8  *OpRomRevision,           OPTIONAL
+  OUT    VOID   **ConfigUtilityCodeHeader OPTIONAL
+  )
+{
+  BOOLEAN                 Match;
+  UINT16                  *DeviceIdList;
+  EFI_PCI_ROM_HEADER      RomHeader;
+  PCI_3_0_DATA_STRUCTURE  *Pcir;
+  VOID                    *BackupImage;
+  VOID                    *BestImage;
+
+
+  if (*ImageSize < sizeof (EFI_PCI_ROM_HEADER)) {
+    return EFI_NOT_FOUND;
+  }
+
+  BestImage     = NULL;
+  BackupImage   = NULL;
+  RomHeader.Raw = *Rom;
+  while (*ImageSize - (RomHeader.Raw - (UINT8 *) *Rom) >= sizeof (PCI_EXPANSION_ROM_HEADER) &&
+         RomHeader.Generic->Signature == PCI_EXPANSION_ROM_HEADER_SIGNATURE) {
+    if (RomHeader.Generic->PcirOffset == 0 ||
+        (RomHeader.Generic->PcirOffset & 3) !=0 ||
+        *ImageSize < RomHeader.Raw - (UINT8 *) *Rom + RomHeader.Generic->PcirOffset + sizeof (PCI_DATA_STRUCTURE)) {
+      break;
+    }
+
+    Pcir = (PCI_3_0_DATA_STRUCTURE *) (RomHeader.Raw + RomHeader.Generic->PcirOffset);
+    //
+    // Check signature in the PCI Data Structure.
+    //
+    if (Pcir->Signature != PCI_DATA_STRUCTURE_SIGNATURE) {
+      break;
+    }
+
+    //
+    // The 3.0 fields must be there too, and an empty image would never end.
+    //
+    if ((Pcir->Revision >= 3 &&
+         *ImageSize < RomHeader.Raw - (UINT8 *) *Rom + RomHeader.Generic->PcirOffset + sizeof (PCI_3_0_DATA_STRUCTURE)) ||
+        Pcir->ImageLength == 0) {
+      break;
+    }
+
+    if (((UINTN)RomHeader.Raw - (UINTN)*Rom) + Pcir->ImageLength * 512 > *ImageSize) {
+      break;
+    }
+
+    if (Pcir->CodeType == PCI_CODE_TYPE_PCAT_IMAGE) {
+      Match = FALSE;
+      if (Pcir->VendorId == VendorId) {
+        if (Pcir->DeviceId == DeviceId) {
+          Match = TRUE;
+        } else if ((Pcir->Revision >= 3) && (Pcir->DeviceListOffset != 0)) {
+          DeviceIdList = (UINT16 *)(((UINT8 *) Pcir) + Pcir->DeviceListOffset);
+          //
+          // Checking the device list
+          //
+          while ((UINT8 *) (DeviceIdList + 1) <= (UINT8 *) *Rom + *ImageSize &&
+                 *DeviceIdList != 0) {
+            if (*DeviceIdList == DeviceId) {
+              Match = TRUE;
+              break;
+            }
+            DeviceIdList ++;
+          }
+        }
+      }
+
+      if (Match) {
+        if (Csm16Revision >= 0x0300) {
+          //
+          // Case 1: CSM16 3.0
+          //
+          if (Pcir->Revision >= 3) {
+            //
+            // case 1.1: meets OpRom 3.0
+            //           Perfect!!!
+            //
+            BestImage  = RomHeader.Raw;
+            break;
+          } else {
+            //
+            // case 1.2: meets OpRom 2.x
+            //           Store it and try to find the OpRom 3.0
+            //
+            BackupImage = RomHeader.Raw;
+          }
+        } else {
+          //
+          // Case 2: CSM16 2.x
+          //
+          if (Pcir->Revision >= 3) {
+            //
+            // case 2.1: meets OpRom 3.0
+            //           Store it and try to find the OpRom 2.x
+            //
+            BackupImage = RomHeader.Raw;
+          } else {
+            //
+            // case 2.2: meets OpRom 2.x
+            //           Perfect!!!
+            //
+            BestImage   = RomHeader.Raw;
+            break;
+          }
+        }
+      } else {
+        DEBUG ((DEBUG_ERROR, "GetPciLegacyRom - OpRom not match (%04x-%04x)\n", (UINT32)VendorId, (UINT32)DeviceId));
+      }
+    }
+
+    if ((Pcir->Indicator & 0x80) == 0x80) {
+      break;
+    } else {
+      RomHeader.Raw += 512 * Pcir->ImageLength;
+    }
+  }
+
+  if (BestImage == NULL) {
+    if (BackupImage == NULL) {
+      return EFI_NOT_FOUND;
+    }
+    //
+    // The versions of CSM16 and OpRom don't match exactly
+    //
+    BestImage = BackupImage;
+  }
+  RomHeader.Raw = BestImage;
+  Pcir = (PCI_3_0_DATA_STRUCTURE *) (RomHeader.Raw + RomHeader.Generic->PcirOffset);
+  *Rom       = BestImage;
+  *ImageSize = Pcir->ImageLength * 512;
+
+  if (MaxRuntimeImageLength != NULL) {
+    if (Pcir->Revision < 3) {
+      *MaxRuntimeImageLength = 0;
+    } else {
+      *MaxRuntimeImageLength = Pcir->MaxRuntimeImageLength * 512;
+    }
+  }
+
+  if (OpRomRevision != NULL) {
+    //
+    // Optional return PCI Data Structure revision
+    //
+    if (Pcir->Length >= 0x1C) {
+      *OpRomRevision = Pcir->Revision;
+    } else {
+      *OpRomRevision = 0;
+    }
+  }
+
+  if (ConfigUtilityCodeHeader != NULL) {
+    //
+    // Optional return ConfigUtilityCodeHeaderOffset supported by the PC-AT ROM
+    //
+    if ((Pcir->Revision < 3) || (Pcir->ConfigUtilityCodeHeaderOffset == 0)) {
+      *ConfigUtilityCodeHeader = NULL;
+    } else {
+      *ConfigUtilityCodeHeader = RomHeader.Raw + Pcir->ConfigUtilityCodeHeaderOffset;
+    }
+  }
+
+  return EFI_SUCCESS;
+}
@@ -0,0 +1,41 @@
+#ifndef OPROM_H
+#define OPROM_H
+
+#include <stdint.h>
+#include <efi.h>
+
+struct csmwrap_priv;
+
+/* Option ROMs dispatched after the VBIOS, not counting it */
+#define OPROM_DISPATCH_MAX  8
+/* Shadow placement granularity, as SeaBIOS does for its own ROMs */
+#define OPROM_ALIGN         0x800
+
+struct oprom_dispatch {
+    /* PC-AT image inside the device's ROM, copied to base after ExitBS */
+    const void *image;
+    uintptr_t size;
+    uintptr_t base;
+    uint8_t bus;
+    uint8_t devfn;
+    uint32_t class_code;
+};
+
+EFI_STATUS
+GetPciLegacyRom (
+  IN     UINT16 Csm16Revision,
+  IN     UINT16 VendorId,
+  IN     UINT16 DeviceId,
+  IN OUT VOID   **Rom,
+  IN OUT UINTN  *ImageSize,
+  OUT    UINTN  *MaxRuntimeImageLength,   OPTIONAL
+  OUT    UINT8  *OpRomRevision,           OPTIONAL
+  OUT    VOID   **ConfigUtilityCodeHeader OPTIONAL
+  );
+
+EFI_STATUS oprom_find_legacy_image(EFI_PCI_IO_PROTOCOL *PciIo, uintptr_t hint,
+                                   VOID **image, UINTN *size, UINTN *runtime_size);
+void oprom_dispatch_collect(struct csmwrap_priv *priv);
+void oprom_dispatch_shadow(struct csmwrap_priv *priv);
+
+#endif
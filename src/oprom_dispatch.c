@@ -0,0 +1,227 @@
+/*
+ * Legacy option ROMs of non-VGA devices.
+ *
+ * The VBIOS is handled by video.c and always lands at VGABIOS_START. Other
+ * devices of the classes below get their PC-AT image packed into the
+ * shadow space left between the end of the VBIOS and the CSM binary, and
+ * one Legacy16DispatchOprom call each after the VGA one.
+ */
+
+#include <efi.h>
+#include <csmwrap.h>
+#include <oprom.h>
+#include <video.h>
+
+/* 0xff matches any sub class */
+static const struct {
+    uint8_t base_class;
+    uint8_t sub_class;
+} oprom_dispatch_classes[] = {
+    { PCI_CLASS_MASS_STORAGE, 0xff },
+    /* Fibre Channel HBAs */
+    { PCI_CLASS_SERIAL, PCI_CLASS_SERIAL_FIBRECHANNEL },
+};
+
+static bool oprom_dispatch_class(uint32_t class_code)
+{
+    uint8_t base_class = class_code >> 16;
+    uint8_t sub_class = class_code >> 8;
+
+    for (size_t i = 0; i < ARRAY_SIZE(oprom_dispatch_classes); i++) {
+        if (oprom_dispatch_classes[i].base_class != base_class) {
+            continue;
+        }
+        if (oprom_dispatch_classes[i].sub_class == 0xff ||
+            oprom_dispatch_classes[i].sub_class == sub_class) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Find the PC-AT image of a device's ROM. A non-zero hint is the offset
+ * the image was found at before, it is only taken if the walk started
+ * there lands on it again. runtime_size, if not NULL, gets the most the
+ * image may grow to during init, 0 for ROMs older than PCI 3.0.
+ */
+EFI_STATUS oprom_find_legacy_image(EFI_PCI_IO_PROTOCOL *PciIo, uintptr_t hint,
+                                   VOID **image, UINTN *size, UINTN *runtime_size)
+{
+    EFI_STATUS Status;
+    UINT32 Id;
+    UINTN LocalRomSize;
+    VOID *LocalRomImage;
+
+    if (!PciIo || !PciIo->RomImage || !PciIo->RomSize) {
+        return EFI_UNSUPPORTED;
+    }
+
+    Status = PciIo->Pci.Read(PciIo, EfiPciIoWidthUint32, 0, 1, &Id);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    if (hint != 0 && hint < PciIo->RomSize) {
+        LocalRomSize  = (UINTN) PciIo->RomSize - hint;
+        LocalRomImage = (UINT8 *) PciIo->RomImage + hint;
+
+        Status = GetPciLegacyRom (
+                 0x0300, // ???
+                 Id & 0xffff,
+                 Id >> 16,
+                 &LocalRomImage,
+                 &LocalRomSize,
+                 runtime_size,
+                 NULL /* OpromRevision */,
+                 NULL /* &LocalConfigUtilityCodeHeader */
+                 );
+
+        if (!EFI_ERROR(Status) &&
+            LocalRomImage == (UINT8 *) PciIo->RomImage + hint) {
+            goto Found;
+        }
+        printf("Cached OpROM image mismatch, probing\n");
+    }
+
+    LocalRomSize  = (UINTN) PciIo->RomSize;
+    LocalRomImage = PciIo->RomImage;
+
+    Status = GetPciLegacyRom (
+             0x0300, // ???
+             Id & 0xffff,
+             Id >> 16,
+             &LocalRomImage,
+             &LocalRomSize,
+             runtime_size,
+             NULL /* OpromRevision */,
+             NULL /* &LocalConfigUtilityCodeHeader */
+             );
+
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+Found:
+    *image = LocalRomImage;
+    *size = LocalRomSize;
+
+    return EFI_SUCCESS;
+}
+
+/*
+ * Pick the ROMs to dispatch and lay them out in shadow space. Nothing is
+ * copied yet, the images stay in firmware memory until ExitBS. They are
+ * all initialized in one batch afterwards, so each one gets room for the
+ * largest runtime image its PCI 3.0 header allows, not only its initial
+ * size.
+ */
+void oprom_dispatch_collect(struct csmwrap_priv *priv)
+{
+    EFI_STATUS Status;
+    EFI_GUID PciIoGuid = EFI_PCI_IO_PROTOCOL_GUID;
+    EFI_HANDLE *HandleBuffer;
+    UINTN HandleCount;
+    uintptr_t next;
+
+    priv->oprom_count = 0;
+    /* The VGA ROM is initialized first and may grow over what follows it */
+    next = vbios_runtime_size > vbios_size ? vbios_runtime_size : vbios_size;
+    next = ALIGN_UP(VGABIOS_START + next, OPROM_ALIGN);
+    if (next < VGABIOS_END) {
+        next = VGABIOS_END;
+    }
+
+    Status = gBS->LocateHandleBuffer(ByProtocol, &PciIoGuid, NULL,
+                                     &HandleCount, &HandleBuffer);
+    if (EFI_ERROR(Status)) {
+        return;
+    }
+
+    for (UINTN i = 0; i < HandleCount; i++) {
+        EFI_PCI_IO_PROTOCOL *PciIo;
+        const struct pci_device *dev;
+        struct oprom_dispatch *oprom;
+        UINTN Segment, Bus, Device, Function;
+        VOID *Image;
+        UINTN Size, RuntimeSize;
+        uintptr_t room;
+
+        if (gBS->HandleProtocol(HandleBuffer[i], &PciIoGuid, (VOID **)&PciIo) != EFI_SUCCESS) {
+            continue;
+        }
+
+        if (PciIo->GetLocation(PciIo, &Segment, &Bus, &Device, &Function) != EFI_SUCCESS ||
+            Segment != 0) {
+            continue;
+        }
+
+        dev = pci_find_device(&priv->pci, Bus, PCI_DEVFN(Device, Function));
+        if (!dev || !oprom_dispatch_class(dev->class_code)) {
+            continue;
+        }
+
+        if (oprom_find_legacy_image(PciIo, 0, &Image, &Size, &RuntimeSize) != EFI_SUCCESS) {
+            continue;
+        }
+        room = RuntimeSize > Size ? RuntimeSize : Size;
+
+        if (priv->oprom_count == OPROM_DISPATCH_MAX) {
+            printf("OpROM %02x:%02x.%x skipped, too many ROMs\n",
+                   dev->bus, PCI_SLOT(dev->devfn), PCI_FUNC(dev->devfn));
+            continue;
+        }
+
+        if (next + room > priv->csm_bin_base) {
+            printf("OpROM %02x:%02x.%x skipped, %lu bytes do not fit in shadow space\n",
+                   dev->bus, PCI_SLOT(dev->devfn), PCI_FUNC(dev->devfn),
+                   (unsigned long)room);
+            continue;
+        }
+
+        oprom = &priv->oproms[priv->oprom_count++];
+        oprom->image = Image;
+        oprom->size = Size;
+        oprom->base = next;
+        oprom->bus = dev->bus;
+        oprom->devfn = dev->devfn;
+        oprom->class_code = dev->class_code;
+
+        next = ALIGN_UP(next + room, OPROM_ALIGN);
+
+        printf("OpROM %02x:%02x.%x class %06x: %lu bytes (%lu at runtime) at 0x%lx\n",
+               dev->bus, PCI_SLOT(dev->devfn), PCI_FUNC(dev->devfn),
+               dev->class_code, (unsigned long)Size, (unsigned long)room,
+               (unsigned long)oprom->base);
+    }
+
+    gBS->FreePool(HandleBuffer);
+
+    if (priv->oprom_count) {
+        printf("OpROM shadow space used: 0x%lx-0x%lx of 0x%lx\n",
+               (unsigned long)priv->oproms[0].base, (unsigned long)next,
+               (unsigned long)priv->csm_bin_base);
+    }
+}
+
+/* Copy the collected ROMs in place and fill their dispatch tables */
+void oprom_dispatch_shadow(struct csmwrap_priv *priv)
+{
+    for (unsigned int i = 0; i < priv->oprom_count; i++) {
+        struct oprom_dispatch *oprom = &priv->oproms[i];
+        EFI_DISPATCH_OPROM_TABLE *table = &priv->low_stub->oprom_tables[i];
+
+        memcpy((void *)oprom->base, oprom->image, oprom->size);
+
+        table->PnPInstallationCheckSegment = priv->csm_efi_table->PnPInstallationCheckSegment;
+        table->PnPInstallationCheckOffset = priv->csm_efi_table->PnPInstallationCheckOffset;
+        /* Entry is at OpromSegment:3, EFI_SEGMENT() would round it down */
+        table->OpromSegment = (uint16_t)(oprom->base >> 4);
+        table->PciBus = oprom->bus;
+        table->PciDeviceFunction = oprom->devfn;
+        table->RuntimeSegment = table->OpromSegment;
+        table->NumberBbsEntries = priv->low_stub->boot_table.NumberBbsEntries;
+        table->BbsTablePointer = priv->low_stub->boot_table.BbsTable;
+    }
+}
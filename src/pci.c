@@ -0,0 +1,303 @@
+#include <efi.h>
+#include <csmwrap.h>
+#include <io.h>
+#include <pci.h>
+
+static void pci_scan_bus(struct pci_inventory *inv, uint8_t bus, uint32_t *seen);
+
+/* Doubles the room of the inventory, false if the pool is exhausted */
+static bool pci_grow(struct pci_inventory *inv)
+{
+    unsigned int max = inv->max ? inv->max * 2 : PCI_INVENTORY_INITIAL;
+    struct pci_device *devices;
+
+    if (EFI_ERROR(gBS->AllocatePool(EfiLoaderData, max * sizeof(*devices),
+                                    (void **)&devices))) {
+        return false;
+    }
+
+    if (inv->devices) {
+        memcpy(devices, inv->devices, inv->count * sizeof(*devices));
+        gBS->FreePool(inv->devices);
+    }
+    inv->devices = devices;
+    inv->max = max;
+
+    return true;
+}
+
+static void pci_add_function(struct pci_inventory *inv, uint8_t bus, uint8_t devfn,
+                             uint32_t id, uint32_t *seen)
+{
+    uint8_t dev = PCI_SLOT(devfn), fn = PCI_FUNC(devfn);
+    struct pci_device *pdev;
+    unsigned int bars, rom_reg;
+
+    if (inv->count >= inv->max && !pci_grow(inv)) {
+        inv->truncated++;
+        return;
+    }
+
+    pdev = &inv->devices[inv->count++];
+    memset(pdev, 0, sizeof(*pdev));
+    pdev->bus = bus;
+    pdev->devfn = devfn;
+    pdev->vendor_id = id & 0xffff;
+    pdev->device_id = id >> 16;
+    pdev->class_code = pciConfigReadDWord(bus, dev, fn, PCI_CLASSCODE_OFFSET - 1) >> 8;
+    pdev->header_type = pciConfigReadByte(bus, dev, fn, PCI_HEADER_TYPE_OFFSET);
+    pdev->int_line = pciConfigReadByte(bus, dev, fn, PCI_INT_LINE_OFFSET);
+
+    switch (pdev->header_type & HEADER_LAYOUT_CODE) {
+        case HEADER_TYPE_DEVICE:
+            bars = PCI_MAX_BAR;
+            rom_reg = PCI_EXPANSION_ROM_BASE;
+            break;
+        case HEADER_TYPE_PCI_TO_PCI_BRIDGE:
+            bars = 2;
+            rom_reg = PCI_BRIDGE_ROMBAR;
+            break;
+        default:
+            return;
+    }
+
+    for (unsigned int i = 0; i < bars; i++) {
+        pdev->bars[i] = pciConfigReadDWord(bus, dev, fn, PCI_BASE_ADDRESSREG_OFFSET + i * 4);
+    }
+    pdev->rom_bar = pciConfigReadDWord(bus, dev, fn, rom_reg);
+
+    if ((pdev->header_type & HEADER_LAYOUT_CODE) == HEADER_TYPE_PCI_TO_PCI_BRIDGE) {
+        uint8_t secondary = pciConfigReadByte(bus, dev, fn,
+                                              PCI_BRIDGE_SECONDARY_BUS_REGISTER_OFFSET);
+        if (secondary > bus) {
+            pci_scan_bus(inv, secondary, seen);
+        }
+    }
+}
+
+static void pci_scan_bus(struct pci_inventory *inv, uint8_t bus, uint32_t *seen)
+{
+    if (seen[bus / 32] & (1u << (bus % 32))) {
+        return;
+    }
+    seen[bus / 32] |= 1u << (bus % 32);
+
+    for (uint8_t dev = 0; dev <= PCI_MAX_DEVICE; dev++) {
+        uint32_t id = pciConfigReadDWord(bus, dev, 0, PCI_VENDOR_ID_OFFSET);
+        uint8_t fns = 1;
+
+        if ((id & 0xffff) == 0xffff || (id & 0xffff) == 0) {
+            continue;
+        }
+
+        if (pciConfigReadByte(bus, dev, 0, PCI_HEADER_TYPE_OFFSET) & HEADER_TYPE_MULTI_FUNCTION) {
+            fns = PCI_MAX_FUNC + 1;
+        }
+
+        for (uint8_t fn = 0; fn < fns; fn++) {
+            if (fn) {
+                id = pciConfigReadDWord(bus, dev, fn, PCI_VENDOR_ID_OFFSET);
+                if ((id & 0xffff) == 0xffff || (id & 0xffff) == 0) {
+                    continue;
+                }
+            }
+
+            pci_add_function(inv, bus, PCI_DEVFN(dev, fn), id, seen);
+        }
+    }
+}
+
+/*
+ * Scans from the root bus of every segment 0 host bridge, the first bus
+ * of the bus number range in its root bridge configuration. Returns the
+ * number of root bridges found.
+ */
+static unsigned int pci_scan_root_bridges(struct pci_inventory *inv, uint32_t *seen)
+{
+    EFI_GUID RootBridgeIoGuid = EFI_PCI_ROOT_BRIDGE_IO_PROTOCOL_GUID;
+    EFI_HANDLE *HandleBuffer;
+    UINTN HandleCount;
+    unsigned int count = 0;
+
+    if (EFI_ERROR(gBS->LocateHandleBuffer(ByProtocol, &RootBridgeIoGuid, NULL,
+                                          &HandleCount, &HandleBuffer))) {
+        return 0;
+    }
+
+    for (UINTN i = 0; i < HandleCount; i++) {
+        EFI_PCI_ROOT_BRIDGE_IO_PROTOCOL *RootBridgeIo;
+        EFI_ACPI_ADDRESS_SPACE_DESCRIPTOR *desc;
+
+        if (gBS->HandleProtocol(HandleBuffer[i], &RootBridgeIoGuid,
+                                (VOID **)&RootBridgeIo) != EFI_SUCCESS ||
+            RootBridgeIo->SegmentNumber != 0 ||
+            RootBridgeIo->Configuration(RootBridgeIo, (VOID **)&desc) != EFI_SUCCESS) {
+            continue;
+        }
+
+        for (; desc->Desc == ACPI_ADDRESS_SPACE_DESCRIPTOR; desc++) {
+            if (desc->ResType == ACPI_ADDRESS_SPACE_TYPE_BUS &&
+                desc->AddrRangeMin <= PCI_MAX_BUS) {
+                pci_scan_bus(inv, desc->AddrRangeMin, seen);
+                count++;
+                break;
+            }
+        }
+    }
+
+    gBS->FreePool(HandleBuffer);
+
+    return count;
+}
+
+/*
+ * Option ROM presence as the PCI bus driver saw it, which includes images
+ * from platform overrides and leaves the ROM BARs of live devices alone.
+ */
+static void pci_mark_roms(struct pci_inventory *inv)
+{
+    EFI_GUID PciIoGuid = EFI_PCI_IO_PROTOCOL_GUID;
+    EFI_HANDLE *HandleBuffer;
+    UINTN HandleCount;
+
+    if (EFI_ERROR(gBS->LocateHandleBuffer(ByProtocol, &PciIoGuid, NULL,
+                                          &HandleCount, &HandleBuffer))) {
+        return;
+    }
+
+    for (UINTN i = 0; i < HandleCount; i++) {
+        EFI_PCI_IO_PROTOCOL *PciIo;
+        UINTN Segment, Bus, Device, Function;
+        struct pci_device *pdev;
+
+        if (gBS->HandleProtocol(HandleBuffer[i], &PciIoGuid, (VOID **)&PciIo) != EFI_SUCCESS ||
+            PciIo->GetLocation(PciIo, &Segment, &Bus, &Device, &Function) != EFI_SUCCESS ||
+            Segment != 0) {
+            continue;
+        }
+
+        pdev = (struct pci_device *)pci_find_device(inv, Bus, PCI_DEVFN(Device, Function));
+        if (pdev) {
+            pdev->has_rom = PciIo->RomSize != 0;
+        }
+    }
+
+    gBS->FreePool(HandleBuffer);
+}
+
+/*
+ * Walks the PCI hierarchy once from each root bus, following bridges.
+ * Without root bridge handles only bus 0 and what hangs off it are seen.
+ * Everything after this should look devices up in the inventory rather
+ * than issuing config cycles of its own.
+ */
+void pci_scan(struct pci_inventory *inv)
+{
+    uint32_t seen[(PCI_MAX_BUS + 1) / 32] = { 0 };
+
+    inv->count = 0;
+    inv->truncated = 0;
+    if (pci_scan_root_bridges(inv, seen) == 0) {
+        pci_scan_bus(inv, 0, seen);
+    }
+    pci_mark_roms(inv);
+
+    printf("PCI inventory: %u functions\n", inv->count);
+    if (inv->truncated) {
+        printf("PCI inventory out of memory, %u functions left out\n", inv->truncated);
+    }
+    if (DEBUG_PRINT_LEVEL & DEBUG_VERBOSE) {
+        for (unsigned int i = 0; i < inv->count; i++) {
+            const struct pci_device *pdev = &inv->devices[i];
+
+            printf("  %02x:%02x.%x %04x:%04x class %06x%s\n",
+                   pdev->bus, PCI_SLOT(pdev->devfn), PCI_FUNC(pdev->devfn),
+                   pdev->vendor_id, pdev->device_id, pdev->class_code,
+                   pdev->has_rom ? " rom" : "");
+        }
+    }
+}
+
+const struct pci_device *pci_find_device(const struct pci_inventory *inv,
+                                         uint8_t bus, uint8_t devfn)
+{
+    for (unsigned int i = 0; i < inv->count; i++) {
+        if (inv->devices[i].bus == bus && inv->devices[i].devfn == devfn) {
+            return &inv->devices[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Next function of the given class after from, or the first one if from is NULL */
+const struct pci_device *pci_find_class(const struct pci_inventory *inv,
+                                        const struct pci_device *from,
+                                        uint8_t base_class, uint8_t sub_class)
+{
+    unsigned int i = from ? (unsigned int)(from - inv->devices) + 1 : 0;
+
+    for (; i < inv->count; i++) {
+        if ((inv->devices[i].class_code >> 16) == base_class &&
+            ((inv->devices[i].class_code >> 8) & 0xff) == sub_class) {
+            return &inv->devices[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Device ID << 16 | vendor ID of 00:00.0, as read from config space */
+uint32_t pci_host_bridge_id(const struct pci_inventory *inv)
+{
+    const struct pci_device *pdev = pci_find_device(inv, 0, 0);
+
+    if (!pdev) {
+        return 0xffffffff;
+    }
+
+    return (uint32_t)pdev->device_id << 16 | pdev->vendor_id;
+}
+
+/*
+ * Location of the PCI function a handle hangs off, found through its
+ * device path. Segments other than 0 are not reachable from legacy code.
+ */
+EFI_STATUS pci_handle_location(EFI_HANDLE handle, uint8_t *bus, uint8_t *devfn)
+{
+    EFI_STATUS Status;
+    EFI_GUID DevicePathGuid = EFI_DEVICE_PATH_PROTOCOL_GUID;
+    EFI_GUID PciIoGuid = EFI_PCI_IO_PROTOCOL_GUID;
+    EFI_DEVICE_PATH *DevicePath;
+    EFI_HANDLE PciHandle;
+    EFI_PCI_IO_PROTOCOL *PciIo;
+    UINTN Segment, Bus, Device, Function;
+
+    Status = gBS->HandleProtocol(handle, &DevicePathGuid, (VOID **)&DevicePath);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    Status = gBS->LocateDevicePath(&PciIoGuid, &DevicePath, &PciHandle);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    Status = gBS->HandleProtocol(PciHandle, &PciIoGuid, (VOID **)&PciIo);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+
+    Status = PciIo->GetLocation(PciIo, &Segment, &Bus, &Device, &Function);
+    if (EFI_ERROR(Status)) {
+        return Status;
+    }
+    if (Segment != 0) {
+        return EFI_UNSUPPORTED;
+    }
+
+    *bus = Bus;
+    *devfn = PCI_DEVFN(Device, Function);
+
+    return EFI_SUCCESS;
+}
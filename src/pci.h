@@ -0,0 +1,51 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <efi.h>
+#include <edk2/Pci.h>
+
+/* Initial room of the inventory, it grows as pci_scan() finds more */
+#define PCI_INVENTORY_INITIAL 128
+
+struct pci_device {
+    uint8_t bus;
+    uint8_t devfn;
+    uint8_t header_type;
+    /* The PCI bus driver found an option ROM image for it */
+    bool has_rom;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    /* Base class << 16 | sub class << 8 | programming interface */
+    uint32_t class_code;
+    /* IRQ the firmware routed to the function, 0xff if none */
+    uint8_t int_line;
+    /* Raw BAR registers, only the first two are BARs on bridges */
+    uint32_t bars[PCI_MAX_BAR];
+    uint32_t rom_bar;
+};
+
+struct pci_inventory {
+    unsigned int count;
+    unsigned int max;
+    /* Functions left out because the inventory could not grow */
+    unsigned int truncated;
+    /* Pool allocated by pci_scan() */
+    struct pci_device *devices;
+};
+
+#define PCI_DEVFN(dev, fn)      ((uint8_t)(((dev) << 3) | (fn)))
+#define PCI_SLOT(devfn)         (((devfn) >> 3) & 0x1f)
+#define PCI_FUNC(devfn)         ((devfn) & 0x07)
+
+void pci_scan(struct pci_inventory *inv);
+const struct pci_device *pci_find_device(const struct pci_inventory *inv,
+                                         uint8_t bus, uint8_t devfn);
+const struct pci_device *pci_find_class(const struct pci_inventory *inv,
+                                        const struct pci_device *from,
+                                        uint8_t base_class, uint8_t sub_class);
+uint32_t pci_host_bridge_id(const struct pci_inventory *inv);
+EFI_STATUS pci_handle_location(EFI_HANDLE handle, uint8_t *bus, uint8_t *devfn);
+
+#endif
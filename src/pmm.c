@@ -0,0 +1,63 @@
+/*
+ * PMM usage of the CSM, as a diagnostic for "make BENCHMARK=1".
+ *
+ * The CSM has no call reporting how much PMM memory it used, so both
+ * areas are filled with a pattern up front and scanned from the bottom
+ * once it is done. The CSM allocates top down, and the lowest word that
+ * lost the pattern is its high-water mark. Memory it allocated but never
+ * wrote still looks unused, so this is a lower bound only and nothing is
+ * handed back to the OS based on it.
+ */
+
+#include <efi.h>
+#include <csmwrap.h>
+#include <pmm.h>
+
+#ifdef CSMWRAP_BENCHMARK
+
+static void pmm_fill(uintptr_t base, uint32_t size)
+{
+    uint32_t *p = (uint32_t *)base;
+
+    for (uint32_t i = 0; i < size / sizeof(*p); i++) {
+        p[i] = PMM_FILL_PATTERN;
+    }
+}
+
+/* Bytes at the bottom of the area still holding the pattern */
+static uint32_t pmm_untouched(uintptr_t base, uint32_t size)
+{
+    const uint32_t *p = (const uint32_t *)base;
+    uint32_t i;
+
+    for (i = 0; i < size / sizeof(*p); i++) {
+        if (p[i] != PMM_FILL_PATTERN) {
+            break;
+        }
+    }
+
+    return i * sizeof(*p);
+}
+
+/* Called once the PMM areas are set in the init table */
+void pmm_prepare(struct csmwrap_priv *priv)
+{
+    EFI_TO_COMPATIBILITY16_INIT_TABLE *init = &priv->low_stub->init_table;
+
+    pmm_fill(init->HiPmmMemory, init->HiPmmMemorySizeInBytes);
+    pmm_fill(init->LowPmmMemory, init->LowPmmMemorySizeInBytes);
+}
+
+/* After PrepareToBoot, the last call that may allocate before Boot */
+void pmm_report(struct csmwrap_priv *priv)
+{
+    EFI_TO_COMPATIBILITY16_INIT_TABLE *init = &priv->low_stub->init_table;
+    uint32_t hi_size = init->HiPmmMemorySizeInBytes;
+    uint32_t low_size = init->LowPmmMemorySizeInBytes;
+
+    printf("PMM: HiPmm 0x%x of 0x%x bytes used, low PMM 0x%x of 0x%x\n",
+           hi_size - pmm_untouched(init->HiPmmMemory, hi_size), hi_size,
+           low_size - pmm_untouched(init->LowPmmMemory, low_size), low_size);
+}
+
+#endif
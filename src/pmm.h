@@ -0,0 +1,12 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include <csmwrap.h>
+
+/* Written over both PMM areas before the CSM starts, "PMM?" */
+#define PMM_FILL_PATTERN    0x3f4d4d50
+
+void pmm_prepare(struct csmwrap_priv *priv);
+void pmm_report(struct csmwrap_priv *priv);
+
+#endif
@@ -12,30 +12,69 @@
 
 #include <efi.h>
 #include <csmwrap.h>
+#include <printf.h>
+#include <cbmem_console.h>
 
-static void _putchar(int character, void *extra_arg) {
-    (void)extra_arg;
+/* Characters staged before a call to OutputString, a line in practice */
+#define PRINTF_LINE_MAX 128
 
-    if (character == '\n') {
-        _putchar('\r', NULL);
+struct printf_line {
+    size_t len;
+    CHAR16 buf[PRINTF_LINE_MAX + 1];
+};
+
+static void flush_line(struct printf_line *line) {
+    if (line->len == 0) {
+        return;
     }
 
-    CHAR16 string[2];
-    string[0] = character;
-    string[1] = 0;
+    line->buf[line->len] = 0;
+    line->len = 0;
 
     if (!gST->ConOut || !gST->ConOut->OutputString) {
         /* No console output available */
         return;
     }
 
-    gST->ConOut->OutputString(gST->ConOut, string);
+    gST->ConOut->OutputString(gST->ConOut, line->buf);
+}
+
+static void _putchar(int character, void *extra_arg) {
+    struct printf_line *line = extra_arg;
+
+    /* Everything printed is kept, whether or not it goes to ConOut */
+    cbmem_console_putc(character);
+
+#ifndef CSMWRAP_QUIET
+    /* Keep room for the \r\n pair */
+    if (line->len > PRINTF_LINE_MAX - 2) {
+        flush_line(line);
+    }
+
+    if (character == '\n') {
+        line->buf[line->len++] = '\r';
+    }
+
+    line->buf[line->len++] = character;
+
+    if (character == '\n') {
+        flush_line(line);
+    }
+#else
+    (void)line;
+#endif
 }
 
 int printf(const char *restrict fmt, ...) {
+    struct printf_line line;
     va_list l;
+
+    line.len = 0;
+
     va_start(l, fmt);
-    int ret = npf_vpprintf(_putchar, NULL, fmt, l);
+    int ret = npf_vpprintf(_putchar, &line, fmt, l);
     va_end(l);
+
+    flush_line(&line);
     return ret;
 }
@@ -1,6 +1,6 @@
 #ifndef PRINTF_H
 #define PRINTF_H
 
-int printf(const char *restrict fmt, ...);
+int printf(const char *restrict fmt, ...) __attribute__((format(__printf__, 1, 2)));
 
 #endif
@@ -0,0 +1,174 @@
+/*
+ * Hard disk image from the ESP, served from RAM as a legacy drive.
+ *
+ * The image is read next to our own before ExitBS into reserved memory
+ * below 4GB. After PrepareToBoot, when the CSM has set up its own drives,
+ * the handler from RamDisk16.S is hooked in front of its INT 13h so the
+ * image becomes drive 80h and the first thing the CSM boots from.
+ */
+
+#include <efi.h>
+#include <csmwrap.h>
+#include <fs.h>
+#include <ramdisk.h>
+
+extern const uint8_t   m16RamDiskStart;
+extern const uint8_t   m16RamDiskEntry;
+extern const uint16_t  m16RamDiskSize;
+
+#define BDA_BASE            0x400
+#define BDA_BASE_MEM_KB     0x13
+#define BDA_HD_COUNT        0x75
+
+/* Cylinders stop at 1024 for CHS callers, LBA covers the rest */
+#define CHS_MAX_CYLINDERS   1024
+
+struct mbr_partition {
+    uint8_t status;
+    uint8_t start_chs[3];
+    uint8_t type;
+    uint8_t end_chs[3];
+    uint32_t start_lba;
+    uint32_t sectors;
+} __attribute__((packed));
+
+/* Geometry the partitions were laid out with, or the usual guess */
+static void ramdisk_geometry(const uint8_t *mbr, uint32_t sectors,
+                             uint16_t *heads, uint16_t *spt)
+{
+    const struct mbr_partition *part = (const void *)(mbr + 0x1be);
+
+    *heads = 0;
+    *spt = 0;
+
+    for (int i = 0; i < 4; i++) {
+        if (part[i].type == 0) {
+            continue;
+        }
+        if (part[i].end_chs[0] + 1 > *heads) {
+            *heads = part[i].end_chs[0] + 1;
+        }
+        if ((part[i].end_chs[1] & 0x3f) > *spt) {
+            *spt = part[i].end_chs[1] & 0x3f;
+        }
+    }
+
+    if (*heads == 0 || *spt == 0) {
+        *spt = 63;
+        *heads = sectors > 16 * 63 * CHS_MAX_CYLINDERS ? 255 : 16;
+    }
+}
+
+int ramdisk_load(struct csmwrap_priv *priv)
+{
+    EFI_STATUS Status;
+    EFI_PHYSICAL_ADDRESS base = 0xffffffff;
+    UINT64 file_size;
+    UINTN size;
+    uint8_t *image;
+    uint32_t sectors, cylinders;
+
+    priv->ramdisk_size = 0;
+
+    if (fs_image_file_size(priv->image_handle, RAMDISK_FILE_NAME, &file_size) != EFI_SUCCESS) {
+        return -1;
+    }
+
+    if (file_size < 512 || file_size % 512 || file_size / 512 > 0xffffffff) {
+        printf("RAM disk: unsupported image size 0x%llx\n", (unsigned long long)file_size);
+        return -1;
+    }
+
+    /* The block moves only take 32bit addresses */
+    Status = gBS->AllocatePages(AllocateMaxAddress, EfiReservedMemoryType,
+                                ALIGN_UP(file_size, EFI_PAGE_SIZE) / EFI_PAGE_SIZE, &base);
+    if (Status != EFI_SUCCESS) {
+        printf("RAM disk: unable to allocate 0x%llx bytes\n", (unsigned long long)file_size);
+        return -1;
+    }
+
+    image = (uint8_t *)(uintptr_t)base;
+    size = file_size;
+    Status = fs_read_image_file(priv->image_handle, RAMDISK_FILE_NAME, image, &size);
+    if (Status != EFI_SUCCESS || size != file_size) {
+        printf("RAM disk: read failed\n");
+        gBS->FreePages(base, ALIGN_UP(file_size, EFI_PAGE_SIZE) / EFI_PAGE_SIZE);
+        return -1;
+    }
+
+    if (image[510] != 0x55 || image[511] != 0xaa) {
+        printf("RAM disk: no MBR signature, floppy and ISO images are not supported\n");
+        gBS->FreePages(base, ALIGN_UP(file_size, EFI_PAGE_SIZE) / EFI_PAGE_SIZE);
+        return -1;
+    }
+
+    sectors = file_size / 512;
+    ramdisk_geometry(image, sectors, &priv->ramdisk_heads, &priv->ramdisk_spt);
+    cylinders = sectors / (priv->ramdisk_heads * priv->ramdisk_spt);
+    if (cylinders > CHS_MAX_CYLINDERS) {
+        cylinders = CHS_MAX_CYLINDERS;
+    }
+    priv->ramdisk_cylinders = cylinders ? cylinders : 1;
+
+    priv->ramdisk_base = base;
+    priv->ramdisk_size = file_size;
+    e820_keep(priv, base, ALIGN_UP(file_size, EFI_PAGE_SIZE));
+
+    printf("RAM disk: %u sectors at 0x%lx, CHS %u/%u/%u\n", sectors,
+           (unsigned long)base, priv->ramdisk_cylinders, priv->ramdisk_heads,
+           priv->ramdisk_spt);
+
+    return 0;
+}
+
+/* Called between PrepareToBoot and Boot, the CSM's INT 13h is final by then */
+void ramdisk_install(struct csmwrap_priv *priv)
+{
+    volatile uint16_t *ivt = NULL;
+    volatile uint8_t *bda = (volatile uint8_t *)BDA_BASE;
+    volatile uint16_t *base_mem_kb = (volatile uint16_t *)(BDA_BASE + BDA_BASE_MEM_KB);
+    RAMDISK16_DATA *data = (RAMDISK16_DATA *)RAMDISK_HANDLER_BASE;
+    uint16_t base_kb;
+
+    _Static_assert (offsetof (RAMDISK16_DATA, base) == 4, "Keep in sync with RamDisk16.S");
+    _Static_assert (offsetof (RAMDISK16_DATA, drive) == 18, "Keep in sync with RamDisk16.S");
+
+    if (priv->ramdisk_size == 0) {
+        return;
+    }
+
+    if (m16RamDiskSize > RAMDISK_HANDLER_SIZE) {
+        printf("RAM disk: handler does not fit\n");
+        return;
+    }
+
+    /* The CSM may have grown the EBDA down over where the handler goes */
+    if ((uintptr_t)*base_mem_kb * 1024 < RAMDISK_HANDLER_BASE + RAMDISK_HANDLER_SIZE) {
+        printf("RAM disk: EBDA at 0x%lx overlaps the handler\n",
+               (unsigned long)*base_mem_kb * 1024);
+        return;
+    }
+
+    /* Keep the compiler from treating the IVT at address 0 as NULL */
+    asm("" : "+r"(ivt));
+
+    memcpy(data, &m16RamDiskStart, m16RamDiskSize);
+    data->old_offset = ivt[0x13 * 2];
+    data->old_segment = ivt[0x13 * 2 + 1];
+    data->base = priv->ramdisk_base;
+    data->sectors = priv->ramdisk_size / 512;
+    data->cylinders = priv->ramdisk_cylinders;
+    data->heads = priv->ramdisk_heads;
+    data->spt = priv->ramdisk_spt;
+    data->drive = RAMDISK_DRIVE;
+
+    ivt[0x13 * 2] = (uint16_t)(&m16RamDiskEntry - &m16RamDiskStart);
+    ivt[0x13 * 2 + 1] = RAMDISK_HANDLER_BASE >> 4;
+
+    bda[BDA_HD_COUNT]++;
+    /* Hide the handler from DOS like the EBDA */
+    base_kb = RAMDISK_HANDLER_BASE / 1024;
+    if (*base_mem_kb > base_kb) {
+        *base_mem_kb = base_kb;
+    }
+}
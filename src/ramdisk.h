@@ -0,0 +1,33 @@
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include <stdint.h>
+#include <csmwrap.h>
+
+/* Disk image next to our own, served as drive 80h when present */
+#define RAMDISK_FILE_NAME       L"csmwrap.img"
+#define RAMDISK_DRIVE           0x80
+
+/* Handler page, taken off the top of low PMM and conventional memory */
+#define RAMDISK_HANDLER_SIZE    0x800
+#define RAMDISK_HANDLER_BASE    (CONVEN_END - RAMDISK_HANDLER_SIZE)
+
+#pragma pack(1)
+/* Keep in sync with RamDisk16.S */
+typedef struct {
+    uint16_t old_offset;
+    uint16_t old_segment;
+    uint32_t base;
+    uint32_t sectors;
+    uint16_t cylinders;
+    uint16_t heads;
+    uint16_t spt;
+    uint8_t drive;
+    uint8_t reserved;
+} RAMDISK16_DATA;
+#pragma pack()
+
+int ramdisk_load(struct csmwrap_priv *priv);
+void ramdisk_install(struct csmwrap_priv *priv);
+
+#endif
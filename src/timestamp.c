@@ -0,0 +1,64 @@
+#include <efi.h>
+#include <csmwrap.h>
+#include <io.h>
+#include <timestamp.h>
+
+static struct timestamp_table *ts_table;
+
+/*
+ * Must be called with boot services alive. entry_tsc is sampled first
+ * thing in efi_main, everything is relative to it.
+ */
+void timestamp_init(uint64_t entry_tsc)
+{
+    EFI_PHYSICAL_ADDRESS addr = 0xffffffff;
+    uint64_t tsc_start;
+
+    if (gBS->AllocatePages(AllocateMaxAddress, EfiRuntimeServicesData,
+                           TIMESTAMP_TABLE_SIZE / EFI_PAGE_SIZE, &addr) != EFI_SUCCESS) {
+        printf("Unable to alloc timestamp table\n");
+        return;
+    }
+
+    ts_table = (struct timestamp_table *)(uintptr_t)addr;
+    memset(ts_table, 0, TIMESTAMP_TABLE_SIZE);
+    ts_table->base_time = entry_tsc;
+    ts_table->max_entries = (TIMESTAMP_TABLE_SIZE - sizeof(struct timestamp_table)) /
+                            sizeof(struct timestamp_entry);
+
+    /* Calibrate TSC against boot services stall, 1ms is precise enough for MHz */
+    tsc_start = rdtsc();
+    gBS->Stall(1000);
+    ts_table->tick_freq_mhz = (uint16_t)((rdtsc() - tsc_start) / 1000);
+
+    ts_table->entries[0].entry_id = TS_EFI_MAIN;
+    ts_table->entries[0].entry_stamp = 0;
+    ts_table->num_entries = 1;
+
+    printf("Timestamp table at %lx, TSC %d MHz\n", (unsigned long)ts_table,
+           ts_table->tick_freq_mhz);
+}
+
+/* For events whose TSC was sampled elsewhere, e.g. in real mode */
+void timestamp_add(enum timestamp_id id, uint64_t tsc)
+{
+    struct timestamp_entry *tse;
+
+    if (!ts_table || ts_table->num_entries >= ts_table->max_entries) {
+        return;
+    }
+
+    tse = &ts_table->entries[ts_table->num_entries++];
+    tse->entry_id = id;
+    tse->entry_stamp = tsc - ts_table->base_time;
+}
+
+void timestamp_add_now(enum timestamp_id id)
+{
+    timestamp_add(id, rdtsc());
+}
+
+struct timestamp_table *timestamp_get_table(void)
+{
+    return ts_table;
+}
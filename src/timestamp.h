@@ -0,0 +1,44 @@
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <stdint.h>
+#include <edk2/Coreboot.h>
+
+/*
+ * Boot phase timestamp IDs, published through CB_TAG_TIMESTAMPS.
+ * coreboot owns the low ID ranges, so ours start at TS_CSMWRAP_BASE.
+ */
+#define TS_CSMWRAP_BASE 4000
+
+/* One page, allocated as runtime data so it ends up reserved in E820 */
+#define TIMESTAMP_TABLE_SIZE    0x1000
+
+enum timestamp_id {
+    TS_EFI_MAIN = TS_CSMWRAP_BASE,
+    TS_UNLOCK_REGION_START,
+    TS_UNLOCK_REGION_END,
+    TS_PLATFORM_WORKAROUNDS_START,
+    TS_PLATFORM_WORKAROUNDS_END,
+    TS_ACPI_INIT_START,
+    TS_ACPI_INIT_END,
+    TS_VIDEO_INIT_START,
+    TS_VIDEO_INIT_END,
+    TS_EXIT_BOOT_SERVICES_START,
+    TS_EXIT_BOOT_SERVICES_END,
+    TS_E820_START,
+    TS_E820_END,
+    TS_LEGACY16_INIT_START,
+    TS_LEGACY16_INIT_END,
+    TS_LEGACY16_DISPATCH_OPROM_START,
+    TS_LEGACY16_DISPATCH_OPROM_END,
+    TS_LEGACY16_PREPARE_TO_BOOT_START,
+    TS_LEGACY16_PREPARE_TO_BOOT_END,
+    TS_LEGACY16_BOOT,
+};
+
+void timestamp_init(uint64_t entry_tsc);
+void timestamp_add(enum timestamp_id id, uint64_t tsc);
+void timestamp_add_now(enum timestamp_id id);
+struct timestamp_table *timestamp_get_table(void);
+
+#endif
@@ -10,6 +10,8 @@
 #include "csmwrap.h"
 #include "edk2/LegacyRegion2.h"
 #include "io.h"
+#include "bootplan.h"
+#include "mtrr.h"
 
 static EFI_GUID gEfiLegacyRegion2ProtocolGuid = EFI_LEGACY_REGION2_PROTOCOL_GUID;
 
@@ -50,6 +52,8 @@ static EFI_GUID gEfiLegacyRegion2ProtocolGuid = EFI_LEGACY_REGION2_PROTOCOL_GUID
 #define AMD_MTRR_FIX4K_WB_DRAM                  0x1E1E1E1E1E1E1E1Eull
 #define AMD_MTRR_FIX4K_WT_DRAM                  0x1C1C1C1C1C1C1C1Cull
 #define AMD_MTRR_FIX4K_UC_DRAM                  0x1818181818181818ull
+/* RdDram and WrDram read as zero once MtrrFixDramModEn is cleared */
+#define AMD_MTRR_FIX_TYPE_MASK                  0x0707070707070707ull
 
 #define MSR_SYS_CFG                         0xC0010010ul
 #define SYS_CFG_MTRR_FIX_DRAM_EN            (1 << 18) ///< Core::X86::Msr::SYS_CFG::MtrrFixDramEn.
@@ -69,6 +73,14 @@ static EFI_GUID gEfiLegacyRegion2ProtocolGuid = EFI_LEGACY_REGION2_PROTOCOL_GUID
 /* AMD Vendor ID */
 #define AMD_VENDOR_ID   0x1022
 
+/*
+ * Smallest unit the region can be unlocked in when nothing better is known,
+ * PAM works on 16KB and AMD fixed MTRRs on 4KB.
+ */
+#define BIOS_REGION_DEFAULT_GRANULARITY 0x1000
+
+static uint32_t bios_region_granularity = BIOS_REGION_DEFAULT_GRANULARITY;
+
 /**
  * Unlock BIOS memory region using the Legacy Region 2 Protocol
  *
@@ -88,7 +100,7 @@ EFI_STATUS unlock_legacy_region_protocol(void)
     );
 
     if (EFI_ERROR(status)) {
-        printf("Legacy Region 2 Protocol not found (status: %lx)\n", status);
+        printf("Legacy Region 2 Protocol not found (status: %lx)\n", (unsigned long)status);
         return status;
     }
 
@@ -108,7 +120,7 @@ EFI_STATUS unlock_legacy_region_protocol(void)
     );
     
     if (EFI_ERROR(status)) {
-        printf("Failed to enable memory reads in legacy region (status: %lx)\n", status);
+        printf("Failed to enable memory reads in legacy region (status: %lx)\n", (unsigned long)status);
         return status;
     }
 
@@ -121,13 +133,19 @@ EFI_STATUS unlock_legacy_region_protocol(void)
     );
 
     if (EFI_ERROR(status)) {
-        printf("Failed to enable memory writes in legacy region (status: %lx)\n", status);
+        printf("Failed to enable memory writes in legacy region (status: %lx)\n", (unsigned long)status);
         return status;
     }
     
     printf("Successfully unlocked legacy region 0xC0000-0xFFFFF using UEFI protocol\n");
     printf("Granularity: 0x%x bytes\n", granularity);
 
+    /* Probe with the protocol's granularity from now on, if it is sane */
+    if (granularity >= sizeof(uint32_t) && granularity <= BIOSROM_END - BIOSROM_START &&
+        !(granularity & (granularity - 1))) {
+        bios_region_granularity = granularity;
+    }
+
     return EFI_SUCCESS;
 }
 
@@ -207,32 +225,31 @@ int unlock_skylake_pam(void)
  */
 int unlock_amd_mtrr(void)
 {
-    uint64_t val;
+    struct mtrr_update update = { 0 };
+    uint64_t sys_cfg;
     printf("Unlocking BIOS region with AMD MTRR\n");
 
-    /* TODO: Investigate SMP impact */
-    val = rdmsr(MSR_SYS_CFG);
-    val |= SYS_CFG_MTRR_FIX_DRAM_MOD_EN;
-    wrmsr(MSR_SYS_CFG, val);
+    /*
+     * The BSP's SYS_CFG is replayed as is on every CPU, so they all end up
+     * with the same fixed MTRRs and DRAM attributes.
+     */
+    sys_cfg = rdmsr(MSR_SYS_CFG);
+    mtrr_update_add(&update, MSR_SYS_CFG, sys_cfg | SYS_CFG_MTRR_FIX_DRAM_MOD_EN);
 
     /* Set all to WB */
-    wrmsr(AMD_AP_MTRR_FIX64k_00000, AMD_MTRR_FIX64K_WB_DRAM);
-    wrmsr(AMD_AP_MTRR_FIX16k_80000, AMD_MTRR_FIX16K_WB_DRAM);
+    mtrr_update_add_masked(&update, AMD_AP_MTRR_FIX64k_00000, AMD_MTRR_FIX64K_WB_DRAM, AMD_MTRR_FIX_TYPE_MASK);
+    mtrr_update_add_masked(&update, AMD_AP_MTRR_FIX16k_80000, AMD_MTRR_FIX16K_WB_DRAM, AMD_MTRR_FIX_TYPE_MASK);
     /* A0000 map to UC IO */
-    wrmsr(AMD_AP_MTRR_FIX16k_A0000, 0x0);
-    wrmsr(AMD_AP_MTRR_FIX4k_C0000, AMD_MTRR_FIX4K_WB_DRAM);
-    wrmsr(AMD_AP_MTRR_FIX4k_C8000, AMD_MTRR_FIX4K_WB_DRAM);
-    wrmsr(AMD_AP_MTRR_FIX4k_D0000, AMD_MTRR_FIX4K_WB_DRAM);
-    wrmsr(AMD_AP_MTRR_FIX4k_D8000, AMD_MTRR_FIX4K_WB_DRAM);
-    wrmsr(AMD_AP_MTRR_FIX4k_E0000, AMD_MTRR_FIX4K_WB_DRAM);
-    wrmsr(AMD_AP_MTRR_FIX4k_E8000, AMD_MTRR_FIX4K_WB_DRAM);
-    wrmsr(AMD_AP_MTRR_FIX4k_F0000, AMD_MTRR_FIX4K_WB_DRAM);
-    wrmsr(AMD_AP_MTRR_FIX4k_F8000, AMD_MTRR_FIX4K_WB_DRAM);
-
-    val = rdmsr(MSR_SYS_CFG);
-    val &= ~SYS_CFG_MTRR_FIX_DRAM_MOD_EN;
-    val |= SYS_CFG_MTRR_FIX_DRAM_EN;
-    wrmsr(MSR_SYS_CFG, val);
+    mtrr_update_add_masked(&update, AMD_AP_MTRR_FIX16k_A0000, 0x0, AMD_MTRR_FIX_TYPE_MASK);
+    for (uint32_t msr = AMD_AP_MTRR_FIX4k_C0000; msr <= AMD_AP_MTRR_FIX4k_F8000; msr++) {
+        mtrr_update_add_masked(&update, msr, AMD_MTRR_FIX4K_WB_DRAM, AMD_MTRR_FIX_TYPE_MASK);
+    }
+
+    sys_cfg &= ~SYS_CFG_MTRR_FIX_DRAM_MOD_EN;
+    sys_cfg |= SYS_CFG_MTRR_FIX_DRAM_EN;
+    mtrr_update_add(&update, MSR_SYS_CFG, sys_cfg);
+
+    mtrr_update_all_cpus(&update);
 
     return 0;
 }
@@ -256,7 +273,7 @@ EFI_STATUS print_legacy_region_info(EFI_LEGACY_REGION2_PROTOCOL *legacy_region)
     );
     
     if (EFI_ERROR(status)) {
-        printf("Failed to get legacy region information (status: %lx)\n", status);
+        printf("Failed to get legacy region information (status: %lx)\n", (unsigned long)status);
         return status;
     }
 
@@ -299,43 +316,163 @@ EFI_STATUS print_legacy_region_info(EFI_LEGACY_REGION2_PROTOCOL *legacy_region)
     return EFI_SUCCESS;
 }
 
+static bool test_dword_rw(uint32_t *ptr)
+{
+    bool ok;
+
+    clflush(ptr);
+    uint32_t val = readl(ptr);
+
+    writel(ptr, ~val);
+    clflush(ptr);
+
+    ok = readl(ptr) == ~val;
+
+    writel(ptr, val);
+
+    return ok;
+}
+
+/*
+ * Test that every granule of the BIOS region is writable. Writes are
+ * enabled per granule, so one dword in each is enough, unless built with
+ * BIOS_REGION_PROBE_EXHAUSTIVE for diagnostics. Failing granules are
+ * reported individually.
+ */
 static bool test_bios_region_rw(void) {
-    uint32_t *bios_region = (uint32_t *)BIOSROM_START;
-    uint32_t *bios_region_end = (uint32_t *)BIOSROM_END;
-    uint32_t *ptr = bios_region;
+    uintptr_t granule;
+    int failed = 0, total = 0;
 
-    while (ptr < bios_region_end) {
-        clflush(ptr);
-        uint32_t val = readl(ptr);
+    for (granule = BIOSROM_START; granule < BIOSROM_END; granule += bios_region_granularity) {
+        uint32_t *ptr = (uint32_t *)granule;
+        bool ok = true;
 
-        writel(ptr, ~val);
-        clflush(ptr);
+#ifdef BIOS_REGION_PROBE_EXHAUSTIVE
+        uint32_t *end = (uint32_t *)(granule + bios_region_granularity);
 
-        if (readl(ptr) != ~val) {
-            printf("Unable to write to BIOS region\n");
-            return false;
+        for (; ptr < end && ok; ptr++) {
+            ok = test_dword_rw(ptr);
         }
+#else
+        ok = test_dword_rw(ptr);
+#endif
+
+        total++;
+        if (!ok) {
+            if (!failed) {
+                printf("Unable to write to BIOS region:");
+            }
+            printf(" %05lx", (unsigned long)granule);
+            failed++;
+        }
+    }
 
-        writel(ptr, val);
-        ptr++;
+    if (failed) {
+        printf(" (%d of %d segments of 0x%x bytes)\n", failed, total, bios_region_granularity);
+        return false;
     }
 
     return true;
 }
 
+/**
+ * Pick the chipset specific unlock method for the host bridge
+ *
+ * @return The method, or CSMWRAP_UNLOCK_NONE if the chipset is unknown
+ */
+static enum csmwrap_unlock_method chipset_unlock_method(struct csmwrap_priv *priv)
+{
+    uint32_t host_bridge_id = pci_host_bridge_id(&priv->pci);
+    printf("Host Bridge ID: 0x%08x\n", host_bridge_id);
+    uint16_t vendor_id = (host_bridge_id & 0xFFFF);
+    uint16_t device_id = (host_bridge_id >> 16) & 0xFFFF;
+
+    switch (vendor_id) {
+        case INTEL_VENDOR_ID:
+            switch (device_id) {
+                case 0x1237: /* 440FX (QEMU) */
+                case 0x7190: /* 440BX/ZX/DX (VMware) */
+                case 0x71A0: /* 440GX */
+                case 0x7194: /* 440MX */
+                case 0x7180: /* 440LX/EX */
+                    return CSMWRAP_UNLOCK_PIIX4;
+                case 0x29C0: /* Q35 (QEMU) */
+                case 0x29E0: /* X38/X48 (VirtualBox) */
+                    return CSMWRAP_UNLOCK_Q35;
+                default:
+                    return CSMWRAP_UNLOCK_SKYLAKE;
+            }
+        case AMD_VENDOR_ID:
+            /* AMD chipsets */
+            return CSMWRAP_UNLOCK_AMD_MTRR;
+        default:
+            printf("Unknown chipset, unable to unlock BIOS region\n");
+            return CSMWRAP_UNLOCK_NONE;
+    }
+}
+
+/**
+ * Unlock the BIOS region with the given method and check the result
+ *
+ * @return 0 on success, non-zero on failure
+ */
+static int unlock_with_method(enum csmwrap_unlock_method method)
+{
+    EFI_STATUS status;
+
+    switch (method) {
+        case CSMWRAP_UNLOCK_ALREADY:
+            status = EFI_SUCCESS;
+            break;
+        case CSMWRAP_UNLOCK_PROTOCOL:
+            status = unlock_legacy_region_protocol();
+            break;
+        case CSMWRAP_UNLOCK_PIIX4:
+            status = unlock_piix4_pam();
+            break;
+        case CSMWRAP_UNLOCK_Q35:
+            status = unlock_q35_pam();
+            break;
+        case CSMWRAP_UNLOCK_SKYLAKE:
+            status = unlock_skylake_pam();
+            break;
+        case CSMWRAP_UNLOCK_AMD_MTRR:
+            status = unlock_amd_mtrr();
+            break;
+        default:
+            status = EFI_UNSUPPORTED;
+            break;
+    }
+
+    return (status == 0 && test_bios_region_rw()) ? 0 : -1;
+}
+
 /**
  * Main function to unlock the BIOS region
- * Tries to use the UEFI protocol first, then falls back to chipset-specific methods
+ * Takes the method from the boot plan cache if there is one, otherwise
+ * tries to use the UEFI protocol first, then falls back to chipset-specific
+ * methods. The method that worked is recorded in priv.
  *
  * @return 0 on success, non-zero on failure
  */
-int unlock_bios_region(void)
+int unlock_bios_region(struct csmwrap_priv *priv)
 {
     EFI_LEGACY_REGION2_PROTOCOL *legacy_region = NULL;
+    const struct bootplan *plan = bootplan_get();
+    enum csmwrap_unlock_method method;
     EFI_STATUS status;
 
+    if (plan && plan->unlock_method != CSMWRAP_UNLOCK_NONE) {
+        if (unlock_with_method(plan->unlock_method) == 0) {
+            priv->unlock_method = plan->unlock_method;
+            return 0;
+        }
+        printf("Cached unlock method %d failed, probing\n", plan->unlock_method);
+    }
+
     // No need to do anything if the region is already unlocked and working.
     if (test_bios_region_rw()) {
+        priv->unlock_method = CSMWRAP_UNLOCK_ALREADY;
         return 0;
     }
 
@@ -351,8 +488,8 @@ int unlock_bios_region(void)
         print_legacy_region_info(legacy_region);
         
         /* Try to unlock using the protocol */
-        status = unlock_legacy_region_protocol();
-        if (!EFI_ERROR(status) && test_bios_region_rw()) {
+        if (unlock_with_method(CSMWRAP_UNLOCK_PROTOCOL) == 0) {
+            priv->unlock_method = CSMWRAP_UNLOCK_PROTOCOL;
             return 0;  /* Success */
         }
 
@@ -363,39 +500,11 @@ int unlock_bios_region(void)
     }
 
     /* Check for known chipsets and use appropriate method */
-    uint32_t host_bridge_id = pciConfigReadDWord(0, 0, 0, 0x0);
-    printf("Host Bridge ID: 0x%08x\n", host_bridge_id);
-    uint16_t vendor_id = (host_bridge_id & 0xFFFF);
-    uint16_t device_id = (host_bridge_id >> 16) & 0xFFFF;
-
-    switch (vendor_id) {
-        case INTEL_VENDOR_ID:
-            switch (device_id) {
-                case 0x1237: /* 440FX (QEMU) */
-                case 0x7190: /* 440BX/ZX/DX (VMware) */
-                case 0x71A0: /* 440GX */
-                case 0x7194: /* 440MX */
-                case 0x7180: /* 440LX/EX */
-                    status = unlock_piix4_pam();
-                    break;
-                case 0x29C0: /* Q35 (QEMU) */
-                case 0x29E0: /* X38/X48 (VirtualBox) */
-                    status = unlock_q35_pam();
-                    break;
-                default:
-                    status = unlock_skylake_pam();
-                    break;
-            }
-            break;
-        case AMD_VENDOR_ID:
-            /* AMD chipsets */
-            status = unlock_amd_mtrr();
-            break;
-        default:
-            status = EFI_UNSUPPORTED;
-            printf("Unknown chipset, unable to unlock BIOS region\n");
-            break;
+    method = chipset_unlock_method(priv);
+    if (method == CSMWRAP_UNLOCK_NONE || unlock_with_method(method)) {
+        return -1;
     }
 
-    return (status == 0 && test_bios_region_rw()) ? 0 : -1;
+    priv->unlock_method = method;
+    return 0;
 }
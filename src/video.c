@@ -2,12 +2,17 @@
 #include <video.h>
 #include <csmwrap.h>
 #include <io.h>
+#include <oprom.h>
+#include <bootplan.h>
+#include <mtrr.h>
+#include <timestamp.h>
 
 // Generated by: xxd -i vgabios.bin >> vgabios.h
 #include <bins/vgabios.h>
 
 void *vbios_loc;
 uintptr_t vbios_size;
+uintptr_t vbios_runtime_size;
 
 static EFI_STATUS FindGopPciDevice(struct csmwrap_priv *priv)
 {
@@ -32,7 +37,7 @@ static EFI_STATUS FindGopPciDevice(struct csmwrap_priv *priv)
                     &HandleBuffer
                     );
     if (EFI_ERROR(Status)) {
-        printf("Failed to locate GOP handles: %d\n", Status);
+        printf("Failed to locate GOP handles: %lx\n", (unsigned long)Status);
         return Status;
     }
 
@@ -68,7 +73,7 @@ static EFI_STATUS FindGopPciDevice(struct csmwrap_priv *priv)
     // We are done with previous handle buffer atm
     gBS->FreePool(HandleBuffer);
     if (EFI_ERROR(Status)) {
-        printf("Failed to get Device Path protocol: %d\n", Status);
+        printf("Failed to get Device Path protocol: %lx\n", (unsigned long)Status);
         goto Out;
     }
 
@@ -79,7 +84,7 @@ static EFI_STATUS FindGopPciDevice(struct csmwrap_priv *priv)
         );
 
     if (EFI_ERROR(Status)) {
-        printf("Failed to locate PCI I/O protocol: %d\n", Status);
+        printf("Failed to locate PCI I/O protocol: %lx\n", (unsigned long)Status);
         goto Out;
     }
 
@@ -92,6 +97,7 @@ static EFI_STATUS FindGopPciDevice(struct csmwrap_priv *priv)
     if (!EFI_ERROR(Status)) {
         UINT16 VendorId, DeviceId;
         UINTN Seg, Bus, Device, Function;
+        const struct pci_device *pdev;
 
         priv->vga_pci_io = PciIo;
 
@@ -106,196 +112,40 @@ static EFI_STATUS FindGopPciDevice(struct csmwrap_priv *priv)
         priv->vga_pci_bus = (UINT8)Bus;
         priv->vga_pci_devfn = (UINT8)(Device << 3 | Function);
 
-        Status = PciIo->Pci.Read(
-                                PciIo,
-                                EfiPciIoWidthUint16,
-                                0, // Vendor ID offset
-                                1,
-                                &VendorId
-                                );
+        pdev = Seg == 0 ? pci_find_device(&priv->pci, priv->vga_pci_bus, priv->vga_pci_devfn) : NULL;
+        if (pdev) {
+            VendorId = pdev->vendor_id;
+            DeviceId = pdev->device_id;
+        } else {
+            Status = PciIo->Pci.Read(
+                                    PciIo,
+                                    EfiPciIoWidthUint16,
+                                    0, // Vendor ID offset
+                                    1,
+                                    &VendorId
+                                    );
 
-        Status = PciIo->Pci.Read(
-                                PciIo,
-                                EfiPciIoWidthUint16,
-                                2, // Device ID offset
-                                1,
-                                &DeviceId
-                                );
+            Status = PciIo->Pci.Read(
+                                    PciIo,
+                                    EfiPciIoWidthUint16,
+                                    2, // Device ID offset
+                                    1,
+                                    &DeviceId
+                                    );
+        }
 
+        priv->vga_pci_id = (UINT32)DeviceId << 16 | VendorId;
 
         printf("GOP PCI: %04x:%02x:%02x.%02x %04x:%04x\n",
-                    Seg, (UINT8)Bus, (UINT8)Device, (UINT8)Function,
+                    (UINT32)Seg, (UINT8)Bus, (UINT8)Device, (UINT8)Function,
                     VendorId, DeviceId);
     } else {
-        printf("Failed to get PCI I/O protocol: %d\n", Status);
+        printf("Failed to get PCI I/O protocol: %lx\n", (unsigned long)Status);
     }
 Out:
   return Status;
 }
 
-static EFI_STATUS
-GetPciLegacyRom (
-  IN     UINT16 Csm16Revision,
-  IN     UINT16 VendorId,
-  IN     UINT16 DeviceId,
-  IN OUT VOID   **Rom,
-  IN OUT UINTN  *ImageSize,
-  OUT    UINTN  *MaxRuntimeImageLength,   OPTIONAL
-  OUT    UINT8  *OpRomRevision,           OPTIONAL
-  OUT    VOID   **ConfigUtilityCodeHeader OPTIONAL
-  )
-{
-  BOOLEAN                 Match;
-  UINT16                  *DeviceIdList;
-  EFI_PCI_ROM_HEADER      RomHeader;
-  PCI_3_0_DATA_STRUCTURE  *Pcir;
-  VOID                    *BackupImage;
-  VOID                    *BestImage;
-
-
-  if (*ImageSize < sizeof (EFI_PCI_ROM_HEADER)) {
-    return EFI_NOT_FOUND;
-  }
-
-  BestImage     = NULL;
-  BackupImage   = NULL;
-  RomHeader.Raw = *Rom;
-  while (RomHeader.Generic->Signature == PCI_EXPANSION_ROM_HEADER_SIGNATURE) {
-    if (RomHeader.Generic->PcirOffset == 0 ||
-        (RomHeader.Generic->PcirOffset & 3) !=0 ||
-        *ImageSize < RomHeader.Raw - (UINT8 *) *Rom + RomHeader.Generic->PcirOffset + sizeof (PCI_DATA_STRUCTURE)) {
-      break;
-    }
-
-    Pcir = (PCI_3_0_DATA_STRUCTURE *) (RomHeader.Raw + RomHeader.Generic->PcirOffset);
-    //
-    // Check signature in the PCI Data Structure.
-    //
-    if (Pcir->Signature != PCI_DATA_STRUCTURE_SIGNATURE) {
-      break;
-    }
-
-    if (((UINTN)RomHeader.Raw - (UINTN)*Rom) + Pcir->ImageLength * 512 > *ImageSize) {
-      break;
-    }
-
-    if (Pcir->CodeType == PCI_CODE_TYPE_PCAT_IMAGE) {
-      Match = FALSE;
-      if (Pcir->VendorId == VendorId) {
-        if (Pcir->DeviceId == DeviceId) {
-          Match = TRUE;
-        } else if ((Pcir->Revision >= 3) && (Pcir->DeviceListOffset != 0)) {
-          DeviceIdList = (UINT16 *)(((UINT8 *) Pcir) + Pcir->DeviceListOffset);
-          //
-          // Checking the device list
-          //
-          while (*DeviceIdList != 0) {
-            if (*DeviceIdList == DeviceId) {
-              Match = TRUE;
-              break;
-            }
-            DeviceIdList ++;
-          }
-        }
-      }
-
-      if (Match) {
-        if (Csm16Revision >= 0x0300) {
-          //
-          // Case 1: CSM16 3.0
-          //
-          if (Pcir->Revision >= 3) {
-            //
-            // case 1.1: meets OpRom 3.0
-            //           Perfect!!!
-            //
-            BestImage  = RomHeader.Raw;
-            break;
-          } else {
-            //
-            // case 1.2: meets OpRom 2.x
-            //           Store it and try to find the OpRom 3.0
-            //
-            BackupImage = RomHeader.Raw;
-          }
-        } else {
-          //
-          // Case 2: CSM16 2.x
-          //
-          if (Pcir->Revision >= 3) {
-            //
-            // case 2.1: meets OpRom 3.0
-            //           Store it and try to find the OpRom 2.x
-            //
-            BackupImage = RomHeader.Raw;
-          } else {
-            //
-            // case 2.2: meets OpRom 2.x
-            //           Perfect!!!
-            //
-            BestImage   = RomHeader.Raw;
-            break;
-          }
-        }
-      } else {
-        DEBUG ((DEBUG_ERROR, "GetPciLegacyRom - OpRom not match (%04x-%04x)\n", (UINTN)VendorId, (UINTN)DeviceId));
-      }
-    }
-
-    if ((Pcir->Indicator & 0x80) == 0x80) {
-      break;
-    } else {
-      RomHeader.Raw += 512 * Pcir->ImageLength;
-    }
-  }
-
-  if (BestImage == NULL) {
-    if (BackupImage == NULL) {
-      return EFI_NOT_FOUND;
-    }
-    //
-    // The versions of CSM16 and OpRom don't match exactly
-    //
-    BestImage = BackupImage;
-  }
-  RomHeader.Raw = BestImage;
-  Pcir = (PCI_3_0_DATA_STRUCTURE *) (RomHeader.Raw + RomHeader.Generic->PcirOffset);
-  *Rom       = BestImage;
-  *ImageSize = Pcir->ImageLength * 512;
-
-  if (MaxRuntimeImageLength != NULL) {
-    if (Pcir->Revision < 3) {
-      *MaxRuntimeImageLength = 0;
-    } else {
-      *MaxRuntimeImageLength = Pcir->MaxRuntimeImageLength * 512;
-    }
-  }
-
-  if (OpRomRevision != NULL) {
-    //
-    // Optional return PCI Data Structure revision
-    //
-    if (Pcir->Length >= 0x1C) {
-      *OpRomRevision = Pcir->Revision;
-    } else {
-      *OpRomRevision = 0;
-    }
-  }
-
-  if (ConfigUtilityCodeHeader != NULL) {
-    //
-    // Optional return ConfigUtilityCodeHeaderOffset supported by the PC-AT ROM
-    //
-    if ((Pcir->Revision < 3) || (Pcir->ConfigUtilityCodeHeaderOffset == 0)) {
-      *ConfigUtilityCodeHeader = NULL;
-    } else {
-      *ConfigUtilityCodeHeader = RomHeader.Raw + Pcir->ConfigUtilityCodeHeaderOffset;
-    }
-  }
-
-  return EFI_SUCCESS;
-}
-
 
 static EFI_STATUS csmwrap_pci_vgaarb(struct csmwrap_priv *priv)
 {
@@ -313,7 +163,7 @@ static EFI_STATUS csmwrap_pci_vgaarb(struct csmwrap_priv *priv)
                                0, &Supported);
 
     if (EFI_ERROR(Status)) {
-        printf("%s: Failed to get supported attributes: %d\n", __func__, Status);
+        printf("%s: Failed to get supported attributes: %lx\n", __func__, (unsigned long)Status);
         return Status;
     }
 
@@ -341,11 +191,11 @@ static EFI_STATUS csmwrap_pci_vgaarb(struct csmwrap_priv *priv)
     Status = PciIo->Attributes(PciIo, EfiPciIoAttributeOperationEnable,
                                Attributes, NULL);
     if (EFI_ERROR(Status)) {
-        printf("%s: Failed to set attributes: %d\n", __func__, Status);
+        printf("%s: Failed to set attributes: %lx\n", __func__, (unsigned long)Status);
         return Status;
     }
 
-    printf("%s: Success! Attributes: %llx\n", __func__, Attributes);
+    printf("%s: Success! Attributes: %llx\n", __func__, (unsigned long long)Attributes);
 
     return 0;
 }
@@ -353,45 +203,31 @@ static EFI_STATUS csmwrap_pci_vgaarb(struct csmwrap_priv *priv)
 static EFI_STATUS csmwrap_video_oprom_init(struct csmwrap_priv *priv)
 {
     EFI_STATUS Status;
-    PCI_TYPE00 PciConfigHeader;
     EFI_PCI_IO_PROTOCOL *PciIo = priv->vga_pci_io;
     UINTN  LocalRomSize;
+    UINTN  LocalRuntimeSize;
     VOID  *LocalRomImage;
+    const struct bootplan *plan;
 
     if (!PciIo || !PciIo->RomImage || !PciIo->RomSize) {
-        DEBUG((DEBUG_ERROR, No PCI I/O protocol or RomImage function\n));
+        DEBUG((DEBUG_ERROR, "No PCI I/O protocol or RomImage function\n"));
         return EFI_UNSUPPORTED;
     }
 
-    LocalRomSize  = (UINTN) PciIo->RomSize;
-    LocalRomImage = PciIo->RomImage;
-
-    PciIo->Pci.Read (
-            PciIo,
-            EfiPciIoWidthUint32,
-            0,
-            sizeof (PciConfigHeader) / sizeof (UINT32),
-            &PciConfigHeader
-            );
-
-    Status = GetPciLegacyRom (
-             0x0300, // ???
-             PciConfigHeader.Hdr.VendorId,
-             PciConfigHeader.Hdr.DeviceId,
-             &LocalRomImage,
-             &LocalRomSize,
-             NULL /* RuntimeImageLength */,
-             NULL /* OpromRevision */,
-             NULL /* &LocalConfigUtilityCodeHeader */
-             );
+    /* Try the image that won last time first */
+    plan = bootplan_get_video(priv);
 
+    Status = oprom_find_legacy_image(PciIo, plan ? plan->rom_offset : 0,
+                                     &LocalRomImage, &LocalRomSize, &LocalRuntimeSize);
     if (EFI_ERROR(Status)) {
-        DEBUG((DEBUG_ERROR, "GetPciLegacyRom failed: %r\n", Status));
+        DEBUG((DEBUG_ERROR, "GetPciLegacyRom failed: %lx\n", (unsigned long)Status));
         return Status;
     }
 
+    priv->vga_rom_offset = (UINT8 *) LocalRomImage - (UINT8 *) PciIo->RomImage;
     vbios_loc = LocalRomImage;
     vbios_size = LocalRomSize;
+    vbios_runtime_size = LocalRuntimeSize;
 
     priv->video_type = CSMWRAP_VIDEO_OPROM;
 
@@ -400,6 +236,27 @@ static EFI_STATUS csmwrap_video_oprom_init(struct csmwrap_priv *priv)
     return 0;
 }
 
+#ifdef CSMWRAP_BENCHMARK
+/* Clears the framebuffer, returns the fill rate in MB/s */
+static uint64_t fb_fill_bandwidth(struct cb_framebuffer *cb_fb)
+{
+    struct timestamp_table *ts = timestamp_get_table();
+    size_t size = (size_t)cb_fb->bytes_per_line * cb_fb->y_resolution;
+    uint64_t start, cycles;
+
+    if (!ts || !ts->tick_freq_mhz) {
+        return 0;
+    }
+
+    start = rdtsc();
+    memset((void *)(uintptr_t)cb_fb->physical_address, 0, size);
+    asm volatile ("sfence" ::: "memory");
+    cycles = rdtsc() - start;
+
+    return cycles ? size * ts->tick_freq_mhz / cycles : 0;
+}
+#endif
+
 static EFI_STATUS csmwrap_video_seavgabios_init(struct csmwrap_priv *priv)
 {
     struct cb_framebuffer *cb_fb = &priv->cb_fb;
@@ -424,7 +281,7 @@ static EFI_STATUS csmwrap_video_seavgabios_init(struct csmwrap_priv *priv)
     }
 
     printf("%c %3d. %4d x%4d (pitch %4d fmt %d r:%06x g:%06x b:%06x)\n",
-        '*', currentMode,
+        '*', (int)currentMode,
         info->HorizontalResolution, info->VerticalResolution, info->PixelsPerScanLine, info->PixelFormat,
         info->PixelFormat==PixelRedGreenBlueReserved8BitPerColor?0xff:(
         info->PixelFormat==PixelBlueGreenRedReserved8BitPerColor?0xff0000:(
@@ -498,6 +355,19 @@ static EFI_STATUS csmwrap_video_seavgabios_init(struct csmwrap_priv *priv)
             return EFI_UNSUPPORTED;
     }
 
+#ifdef CSMWRAP_BENCHMARK
+    uint64_t fill_before = fb_fill_bandwidth(cb_fb);
+#endif
+
+    /* SeaVGABIOS and the legacy OS render text straight into the framebuffer */
+    mtrr_set_wc(cb_fb->physical_address, (uint64_t)cb_fb->bytes_per_line * cb_fb->y_resolution);
+
+#ifdef CSMWRAP_BENCHMARK
+    printf("bench fb fill: %llu MB/s before, %llu MB/s after\n",
+           (unsigned long long)fill_before,
+           (unsigned long long)fb_fill_bandwidth(cb_fb));
+#endif
+
     vbios_loc = vgabios_bin;
     vbios_size = sizeof(vgabios_bin);
 
@@ -563,7 +433,7 @@ EFI_STATUS csmwrap_video_prepare_exitbs(struct csmwrap_priv *priv)
                         );
 
         if (EFI_ERROR(Status)) {
-            DEBUG((DEBUG_ERROR, "DisconnectController failed: %d\n", Status));
+            DEBUG((DEBUG_ERROR, "DisconnectController failed: %lx\n", (unsigned long)Status));
             return Status;
         }
     }
@@ -573,6 +443,7 @@ EFI_STATUS csmwrap_video_prepare_exitbs(struct csmwrap_priv *priv)
 
 EFI_STATUS csmwrap_video_init(struct csmwrap_priv *priv)
 {
+    const struct bootplan *plan;
     EFI_STATUS status;
 
     status = FindGopPciDevice(priv);
@@ -587,9 +458,13 @@ EFI_STATUS csmwrap_video_init(struct csmwrap_priv *priv)
         status = csmwrap_pci_vgaarb(priv);
     }
 
-    status = csmwrap_video_oprom_init(priv);
-    if (status == EFI_SUCCESS) {
-        return 0;
+    /* No need to walk the ROM again if it had no usable image last time */
+    plan = bootplan_get_video(priv);
+    if (!plan || plan->video_type != CSMWRAP_VIDEO_SEAVGABIOS) {
+        status = csmwrap_video_oprom_init(priv);
+        if (status == EFI_SUCCESS) {
+            return 0;
+        }
     }
 
     status = csmwrap_video_seavgabios_init(priv);
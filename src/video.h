@@ -7,6 +7,8 @@
 
 extern void *vbios_loc;
 extern uintptr_t vbios_size;
+/* Most a vendor VBIOS may grow to during init, 0 if it does not say */
+extern uintptr_t vbios_runtime_size;
 
 EFI_STATUS csmwrap_video_init(struct csmwrap_priv *priv);
 EFI_STATUS csmwrap_video_prepare_exitbs(struct csmwrap_priv *priv);
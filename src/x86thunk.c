@@ -11,6 +11,8 @@
 #include <libc.h>
 #include <printf.h>
 #include "csmwrap.h"
+#include "io.h"
+#include "timestamp.h"
 
 // FIXME: Are we going to implement it?
 #define ASSERT(x)
@@ -21,6 +23,8 @@ extern const uint16_t  mThunk16Attr;
 extern const uint16_t  m16Gdt;
 extern const uint16_t  m16GdtrBase;
 extern const uint16_t  mTransition;
+extern const uint8_t   m16BatchStart;
+extern const uint16_t  m16BatchSize;
 
 /**
   Invokes 16-bit code in big real mode and returns the updated register set.
@@ -250,13 +254,14 @@ void AsmPrepareAndThunk16 (THUNK_CONTEXT *ThunkContext)
 
 THUNK_CONTEXT  mThunkContext;
 
-bool InternalLegacyBiosFarCall (uint16_t Segment, uint16_t Offset, EFI_IA32_REGISTER_SET *Regs, void *Stack, uintptr_t StackSize)
+bool InternalLegacyBiosFarCall (THUNK_CALL_TYPE Type, uint16_t Segment, uint16_t Offset, EFI_IA32_REGISTER_SET *Regs, void *Stack, uintptr_t StackSize)
 {
+  uint64_t              StartTsc;
+  uintptr_t             IrqFlags;
 //  uintptr_t                 Status;
   uint16_t                *Stack16;
 //  EFI_TPL               OriginalTpl;
   IA32_REGISTER_SET     ThunkRegSet;
-//  bool               InterruptState;
 //  uint64_t                TimerPeriod;
 
   memset(&ThunkRegSet, 0, sizeof (ThunkRegSet));
@@ -363,7 +368,16 @@ bool InternalLegacyBiosFarCall (uint16_t Segment, uint16_t Offset, EFI_IA32_REGI
   // Status = Private->Legacy8259->SetMode (Private->Legacy8259, Efi8259LegacyMode, NULL, NULL);
   // ASSERT_EFI_ERROR (Status);
 
+  //
+  // Real mode runs on the legacy IVT, so keep the UEFI IDT from seeing
+  // interrupts during the switch.
+  //
+  IrqFlags = irq_save ();
+  StartTsc = rdtsc ();
   AsmThunk16 (&mThunkContext);
+  mThunkContext.Stats[Type].Cycles += rdtsc () - StartTsc;
+  mThunkContext.Stats[Type].Count++;
+  irq_restore (IrqFlags);
 
   if ((Stack != NULL) && (StackSize != 0)) {
     //
@@ -445,7 +459,7 @@ uintptr_t LegacyBiosInitializeThunkAndTable(uintptr_t MemoryAddress, size_t data
 
   memset(mThunkContext.RealModeBuffer, 0, mThunkContext.RealModeBufferSize);
 
-  printf("RealmodeBuffer %lx\n", (uintptr_t)mThunkContext.RealModeBuffer);
+  printf("RealmodeBuffer %lx\n", (unsigned long)mThunkContext.RealModeBuffer);
 
   AsmPrepareThunk16 (&mThunkContext);
 
@@ -454,11 +468,18 @@ uintptr_t LegacyBiosInitializeThunkAndTable(uintptr_t MemoryAddress, size_t data
 
 bool LegacyBiosInt86(uint8_t BiosInt, EFI_IA32_REGISTER_SET *Regs)
 {
-  uint16_t Segment;
-  uint16_t Offset;
-
-  /* FIXME: Not working!!!!!!!!!!!! */
+  uint16_t  Segment;
+  uint16_t  Offset;
+  uint32_t  *Ivt;
+  uint64_t  StartTsc;
+  bool      Ret;
 
+  //
+  // Handlers are entered like INT does it: IF and TF clear, with FLAGS, CS
+  // and IP on the stack. The thunk pushes the return CS:IP right below the
+  // Stack copy, so passing the flags as Stack gives the handler a proper IRET
+  // frame. The handler's result flags come back from the live FLAGS either way.
+  //
   Regs->X.Flags.Reserved1 = 1;
   Regs->X.Flags.Reserved2 = 0;
   Regs->X.Flags.Reserved3 = 0;
@@ -469,23 +490,38 @@ bool LegacyBiosInt86(uint8_t BiosInt, EFI_IA32_REGISTER_SET *Regs)
   Regs->X.Flags.TF        = 0;
   Regs->X.Flags.CF        = 0;
 
-
   //
   // The base address of legacy interrupt vector table is 0.
   // We use this base address to get the legacy interrupt handler.
+  // Hide the NULL from the compiler, it would turn the read into a trap.
   //
+  Ivt = NULL;
+  asm ("" : "+r" (Ivt));
+
   ACCESS_PAGE0_CODE (
-    Segment = (UINT16)(((UINT32 *)0)[BiosInt] >> 16);
-    Offset  = (UINT16)((UINT32 *)0)[BiosInt];
+    Segment = (uint16_t)(Ivt[BiosInt] >> 16);
+    Offset  = (uint16_t)Ivt[BiosInt];
     );
 
-  return InternalLegacyBiosFarCall (
-           Segment,
-           Offset,
-           Regs,
-           &Regs->X.Flags,
-           sizeof (Regs->X.Flags)
-           );
+  if ((Segment == 0) && (Offset == 0)) {
+    DEBUG ((DEBUG_ERROR, "INT %02x has no handler\n", BiosInt));
+    Regs->X.Flags.CF = 1;
+    return true;
+  }
+
+  StartTsc = rdtsc ();
+  Ret      = InternalLegacyBiosFarCall (
+               ThunkCallInt86,
+               Segment,
+               Offset,
+               Regs,
+               &Regs->X.Flags,
+               sizeof (Regs->X.Flags)
+               );
+  mThunkContext.Int86Stats[BiosInt].Cycles += rdtsc () - StartTsc;
+  mThunkContext.Int86Stats[BiosInt].Count++;
+
+  return Ret;
 }
 
 /**
@@ -518,5 +554,245 @@ bool LegacyBiosFarCall86 (uint16_t Segment, uint16_t Offset, EFI_IA32_REGISTER_S
   Regs->X.Flags.TF        = 0;
   Regs->X.Flags.CF        = 0;
 
-  return InternalLegacyBiosFarCall (Segment, Offset, Regs, Stack, StackSize);
+  return InternalLegacyBiosFarCall (ThunkCallFar, Segment, Offset, Regs, Stack, StackSize);
+}
+
+/**
+  Run several Legacy16 functions back to back with a single thunk into real
+  mode, instead of one round trip each.
+
+  The trampoline from Thunk16Batch.S and a copy of the steps are placed in
+  the page between the thunk buffer and low PMM. Every step is run even if
+  an earlier one failed, Status and Flags of each step hold AX and FLAGS as
+  the CSM returned them.
+
+  @param  Segment                Segment of the Legacy16 entry point
+  @param  Offset                 Offset of the Legacy16 entry point
+  @param  Steps                  Functions to call, updated with the results
+  @param  Count                  Number of steps
+
+  @retval FALSE                  All steps were run, see Steps for status.
+  @retval TRUE                   The batch does not fit below 1MB.
+
+**/
+bool LegacyBiosBatchFarCall86 (uint16_t Segment, uint16_t Offset, LEGACY16_BATCH_STEP *Steps, uintptr_t Count)
+{
+  uint8_t                *Code;
+  LEGACY16_BATCH         *Batch;
+  EFI_IA32_REGISTER_SET  Regs;
+
+  _Static_assert (offsetof (LEGACY16_BATCH, Count) == 4, "Keep in sync with Thunk16Batch.S");
+  _Static_assert (offsetof (LEGACY16_BATCH, Steps) == 6, "Keep in sync with Thunk16Batch.S");
+  _Static_assert (offsetof (LEGACY16_BATCH_STEP, EndTsc) == 10, "Keep in sync with Thunk16Batch.S");
+  _Static_assert (sizeof (LEGACY16_BATCH_STEP) == 18, "Keep in sync with Thunk16Batch.S");
+
+  Code  = (uint8_t *)mThunkContext.RealModeBuffer + mThunkContext.RealModeBufferSize;
+  Batch = (LEGACY16_BATCH *)(Code + ALIGN_UP (m16BatchSize, 16));
+
+  if (ALIGN_UP (m16BatchSize, 16) + sizeof (*Batch) + Count * sizeof (*Steps) > EFI_PAGE_SIZE) {
+    DEBUG ((DEBUG_ERROR, "Legacy16 batch of %u steps is too large\n", (UINT32)Count));
+    return TRUE;
+  }
+
+  memcpy (Code, &m16BatchStart, m16BatchSize);
+  Batch->EntryOffset  = Offset;
+  Batch->EntrySegment = Segment;
+  Batch->Count        = (uint16_t)Count;
+  memcpy (Batch->Steps, Steps, Count * sizeof (*Steps));
+
+  memset (&Regs, 0, sizeof (Regs));
+  Regs.X.DS = EFI_SEGMENT (Batch);
+  Regs.X.SI = EFI_OFFSET (Batch);
+
+  Regs.X.Flags.Reserved1 = 1;
+  Regs.X.Flags.IOPL      = 3;
+  Regs.X.Flags.IF        = 1;
+
+  InternalLegacyBiosFarCall (ThunkCallBatch, EFI_SEGMENT (Code), EFI_OFFSET (Code), &Regs, NULL, 0);
+
+  memcpy (Steps, Batch->Steps, Count * sizeof (*Steps));
+
+  return FALSE;
+}
+
+/**
+  Print how many calls of each type went through the thunk and the
+  average number of TSC cycles they took, real mode code included.
+**/
+void LegacyBiosDumpThunkStats (void)
+{
+  static const char  *Names[ThunkCallTypeMax] = {
+    [ThunkCallFar]   = "far call",
+    [ThunkCallInt86] = "int86",
+    [ThunkCallBatch] = "batch",
+  };
+  uintptr_t          Type;
+
+  for (Type = 0; Type < ThunkCallTypeMax; Type++) {
+    THUNK_CALL_STATS  *Stats = &mThunkContext.Stats[Type];
+
+    if (Stats->Count == 0) {
+      continue;
+    }
+
+    printf ("thunk %-8s: %u calls, %llu cycles avg\n", Names[Type], Stats->Count,
+            (unsigned long long)(Stats->Cycles / Stats->Count));
+  }
+
+  for (Type = 0; Type < ARRAY_SIZE (mThunkContext.Int86Stats); Type++) {
+    THUNK_CALL_STATS  *Stats = &mThunkContext.Int86Stats[Type];
+
+    if (Stats->Count == 0) {
+      continue;
+    }
+
+    printf ("  int %02x    : %u calls, %llu cycles avg\n", (unsigned)Type, Stats->Count,
+            (unsigned long long)(Stats->Cycles / Stats->Count));
+  }
+}
+
+#ifdef CSMWRAP_BENCHMARK
+
+#define THUNK_BENCH_ITERATIONS  1000
+
+static uint64_t  mThunkBenchSamples[THUNK_BENCH_ITERATIONS];
+
+/**
+  Sort the first Count samples and print their distribution.
+**/
+static void BenchReport (const char *Name, uintptr_t Count)
+{
+  struct timestamp_table *ts = timestamp_get_table ();
+  uint64_t               Mhz = ts ? ts->tick_freq_mhz : 0;
+  uintptr_t              Index;
+  uintptr_t              Sorted;
+
+  // Insertion sort, the samples are mostly in order already
+  for (Sorted = 1; Sorted < Count; Sorted++) {
+    uint64_t  Sample = mThunkBenchSamples[Sorted];
+
+    for (Index = Sorted; Index > 0 && mThunkBenchSamples[Index - 1] > Sample; Index--) {
+      mThunkBenchSamples[Index] = mThunkBenchSamples[Index - 1];
+    }
+
+    mThunkBenchSamples[Index] = Sample;
+  }
+
+  printf ("bench %s: %u calls: min %llu, median %llu, p99 %llu cycles",
+          Name,
+          (unsigned)Count,
+          (unsigned long long)mThunkBenchSamples[0],
+          (unsigned long long)mThunkBenchSamples[Count / 2],
+          (unsigned long long)mThunkBenchSamples[Count * 99 / 100]);
+  if (Mhz) {
+    printf (" (median %llu ns)", (unsigned long long)(mThunkBenchSamples[Count / 2] * 1000 / Mhz));
+  }
+
+  printf ("\n");
+}
+
+/**
+  Measure the cost of a real mode round trip through the thunk, by far
+  calling a lone RETF placed in the page between the thunk buffer and low
+  PMM, which nothing else uses.
+
+  Must be called after LegacyBiosInitializeThunkAndTable(). The IVT may
+  still belong to UEFI, so the INT 15h A20 call on the way back is disabled
+  while benchmarking.
+**/
+void bench_thunk (void)
+{
+  uint8_t                *Stub;
+  uint32_t               Attributes;
+  EFI_IA32_REGISTER_SET  Regs;
+  THUNK_CALL_STATS       SavedStats;
+  uintptr_t              Index;
+
+  Stub  = (uint8_t *)mThunkContext.RealModeBuffer + mThunkContext.RealModeBufferSize;
+  *Stub = 0xCB; // retf
+
+  Attributes                    = mThunkContext.ThunkAttributes;
+  mThunkContext.ThunkAttributes = Attributes & ~THUNK_ATTRIBUTE_DISABLE_A20_MASK_INT_15;
+  AsmPrepareThunk16 (&mThunkContext);
+
+  SavedStats = mThunkContext.Stats[ThunkCallFar];
+
+  for (Index = 0; Index < THUNK_BENCH_ITERATIONS; Index++) {
+    uint64_t  Start;
+
+    memset (&Regs, 0, sizeof (Regs));
+    Regs.X.Flags.Reserved1 = 1;
+    Regs.X.Flags.IOPL      = 3;
+
+    Start = rdtsc ();
+    InternalLegacyBiosFarCall (ThunkCallFar, EFI_SEGMENT (Stub), EFI_OFFSET (Stub), &Regs, NULL, 0);
+    mThunkBenchSamples[Index] = rdtsc () - Start;
+  }
+
+  mThunkContext.Stats[ThunkCallFar] = SavedStats;
+  mThunkContext.ThunkAttributes     = Attributes;
+  AsmPrepareThunk16 (&mThunkContext);
+  *Stub = 0;
+
+  BenchReport ("thunk", THUNK_BENCH_ITERATIONS);
 }
+
+typedef struct {
+  uint8_t     Int;
+  uint16_t    AX;
+  uint8_t     DL;
+  const char  *Name;
+} INT86_BENCH_CALL;
+
+//
+// Services that only read state, so they are safe to call before boot
+//
+static const INT86_BENCH_CALL  mInt86BenchCalls[] = {
+  { 0x11, 0x0000, 0x00, "int 11 equipment"    },
+  { 0x12, 0x0000, 0x00, "int 12 memory size"  },
+  { 0x1A, 0x0000, 0x00, "int 1a tick count"   },
+  { 0x16, 0x0100, 0x00, "int 16 key status"   },
+  { 0x10, 0x0F00, 0x00, "int 10 video mode"   },
+  { 0x13, 0x0800, 0x80, "int 13 drive params" },
+};
+
+/**
+  Measure the round trip cost of a few read-only BIOS services through
+  LegacyBiosInt86(), to tell which probes are cheap enough for every boot.
+
+  Must be called once the CSM owns the IVT, i.e. after Legacy16InitializeYourself.
+**/
+void bench_int86 (void)
+{
+  EFI_IA32_REGISTER_SET  Regs;
+  THUNK_CALL_STATS       SavedStats[ARRAY_SIZE (mThunkContext.Int86Stats)];
+  THUNK_CALL_STATS       SavedInt86;
+  uintptr_t              Call;
+  uintptr_t              Index;
+
+  memcpy (SavedStats, mThunkContext.Int86Stats, sizeof (SavedStats));
+  SavedInt86 = mThunkContext.Stats[ThunkCallInt86];
+
+  for (Call = 0; Call < ARRAY_SIZE (mInt86BenchCalls); Call++) {
+    const INT86_BENCH_CALL  *Bench = &mInt86BenchCalls[Call];
+
+    for (Index = 0; Index < THUNK_BENCH_ITERATIONS; Index++) {
+      uint64_t  Start;
+
+      memset (&Regs, 0, sizeof (Regs));
+      Regs.X.AX = Bench->AX;
+      Regs.H.DL = Bench->DL;
+
+      Start = rdtsc ();
+      LegacyBiosInt86 (Bench->Int, &Regs);
+      mThunkBenchSamples[Index] = rdtsc () - Start;
+    }
+
+    BenchReport (Bench->Name, THUNK_BENCH_ITERATIONS);
+  }
+
+  memcpy (mThunkContext.Int86Stats, SavedStats, sizeof (SavedStats));
+  mThunkContext.Stats[ThunkCallInt86] = SavedInt86;
+}
+
+#endif
@@ -199,6 +199,21 @@ typedef union {
   uint64_t    Uint64;
 } IA32_SEGMENT_DESCRIPTOR;
 
+///
+/// Kinds of real mode calls going through the thunk, for statistics.
+///
+typedef enum {
+  ThunkCallFar,
+  ThunkCallInt86,
+  ThunkCallBatch,
+  ThunkCallTypeMax
+} THUNK_CALL_TYPE;
+
+typedef struct {
+  uint32_t    Count;
+  uint64_t    Cycles;     ///< TSC cycles spent in the thunk, real mode code included.
+} THUNK_CALL_STATS;
+
 ///
 /// Byte packed structure for an 16-bit real mode thunks.
 ///
@@ -207,6 +222,8 @@ typedef struct {
   void                 *RealModeBuffer;
   uint32_t               RealModeBufferSize;
   uint32_t               ThunkAttributes;
+  THUNK_CALL_STATS       Stats[ThunkCallTypeMax];
+  THUNK_CALL_STATS       Int86Stats[256];   ///< ThunkCallInt86 calls by vector.
 } THUNK_CONTEXT;
 
 #define THUNK_ATTRIBUTE_BIG_REAL_MODE              0x00000001
@@ -284,10 +301,35 @@ typedef struct {
   uint8_t                              Stack[LOW_STACK_SIZE];
 } LOW_MEMORY_THUNK;
 
+///
+/// One Legacy16 call in a batch, see Thunk16Batch.S.
+///
+typedef struct {
+  uint16_t    Function;       ///< Legacy16 function, passed in AX.
+  uint16_t    TableSegment;   ///< Function table, passed in ES:BX.
+  uint16_t    TableOffset;
+  uint16_t    Status;         ///< AX on return.
+  uint16_t    Flags;          ///< FLAGS on return.
+  uint64_t    EndTsc;         ///< TSC right after the function returned.
+} LEGACY16_BATCH_STEP;
+
+typedef struct {
+  uint16_t               EntryOffset;   ///< Compatibility16CallOffset.
+  uint16_t               EntrySegment;  ///< Compatibility16CallSegment.
+  uint16_t               Count;
+  LEGACY16_BATCH_STEP    Steps[];
+} LEGACY16_BATCH;
+
 #pragma pack()
 
 extern uintptr_t LegacyBiosInitializeThunkAndTable(uintptr_t MemoryAddress, size_t data_size);
 
 extern bool LegacyBiosFarCall86 (uint16_t Segment, uint16_t Offset, EFI_IA32_REGISTER_SET *Regs, void *Stack, uintptr_t StackSize);
 
+extern bool LegacyBiosInt86 (uint8_t BiosInt, EFI_IA32_REGISTER_SET *Regs);
+
+extern bool LegacyBiosBatchFarCall86 (uint16_t Segment, uint16_t Offset, LEGACY16_BATCH_STEP *Steps, uintptr_t Count);
+
+extern void LegacyBiosDumpThunkStats (void);
+
 #endif
@@ -0,0 +1,166 @@
+/*
+ * Host timing loops for the map building, ROM parsing and copy paths,
+ * see "make bench". Numbers are per call, best of several rounds.
+ */
+
+#include <string.h>
+
+#include <efi.h>
+#include <csmwrap.h>
+#include <oprom.h>
+
+#include "test.h"
+
+void *libc_memcpy(void *restrict dest, const void *restrict src, size_t n);
+void *libc_memset(void *s, int c, size_t n);
+extern int libc_erms_supported;
+
+#define ROUNDS  5
+
+static struct csmwrap_priv priv;
+static struct low_stub stub;
+
+/* Keeps the optimizer from dropping the work */
+static volatile uintptr_t sink;
+
+static void report(const char *name, uint64_t best_ns, unsigned int calls)
+{
+    printf("%-32s %10.1f ns/call\n", name, (double)best_ns / calls);
+}
+
+static void bench_e820(int descriptors)
+{
+    static EFI_MEMORY_DESCRIPTOR source[4096], work[4096];
+    uint64_t rng = 0x62656e6368;
+    uint64_t addr = 0x100000, best = ~0ULL;
+    unsigned int calls = 200000 / descriptors;
+    char name[64];
+
+    /* Shuffled alternating RAM and reserved, like a fragmented server map */
+    for (int i = 0; i < descriptors; i++) {
+        source[i] = (EFI_MEMORY_DESCRIPTOR) {
+            .Type = i & 1 ? EfiRuntimeServicesData : EfiConventionalMemory,
+            .PhysicalStart = addr,
+            .NumberOfPages = 1 + test_rand_range(&rng, 64),
+        };
+        addr += source[i].NumberOfPages * EFI_PAGE_SIZE;
+    }
+    for (int i = descriptors - 1; i > 0; i--) {
+        int j = test_rand_range(&rng, i + 1);
+        EFI_MEMORY_DESCRIPTOR tmp = source[i];
+        source[i] = source[j];
+        source[j] = tmp;
+    }
+
+    priv.low_stub = &stub;
+    for (int round = 0; round < ROUNDS; round++) {
+        uint64_t start = test_now_ns();
+
+        for (unsigned int i = 0; i < calls; i++) {
+            /* The builder works in place, so every call gets a fresh copy */
+            memcpy(work, source, descriptors * sizeof(*work));
+            build_e820_map(&priv, work, descriptors * sizeof(*work), sizeof(*work));
+        }
+
+        uint64_t elapsed = test_now_ns() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+
+    snprintf(name, sizeof(name), "build_e820_map %d desc", descriptors);
+    report(name, best, calls);
+}
+
+static void bench_oprom(void)
+{
+    static uint8_t rom[128 * 1024];
+    uint64_t best = ~0ULL;
+    const unsigned int calls = 1000000;
+    const int images = 16;
+
+    /* The PC-AT image comes last behind a run of EFI images */
+    for (int i = 0; i < images; i++) {
+        uint8_t *p = rom + i * 8 * 512;
+        PCI_3_0_DATA_STRUCTURE *pcir = (PCI_3_0_DATA_STRUCTURE *)(p + 0x1c);
+
+        p[0] = 0x55;
+        p[1] = 0xaa;
+        p[0x18] = 0x1c;
+        pcir->Signature = PCI_DATA_STRUCTURE_SIGNATURE;
+        pcir->VendorId = 0x8086;
+        pcir->DeviceId = 0x1234;
+        pcir->Length = sizeof(*pcir);
+        pcir->Revision = 3;
+        pcir->ImageLength = 8;
+        pcir->CodeType = i == images - 1 ? PCI_CODE_TYPE_PCAT_IMAGE : 3;
+        pcir->Indicator = i == images - 1 ? 0x80 : 0;
+    }
+
+    for (int round = 0; round < ROUNDS; round++) {
+        uint64_t start = test_now_ns();
+
+        for (unsigned int i = 0; i < calls; i++) {
+            void *image = rom;
+            UINTN size = sizeof(rom);
+
+            GetPciLegacyRom(0x0300, 0x8086, 0x1234, &image, &size, NULL, NULL, NULL);
+            sink = (uintptr_t)image;
+        }
+
+        uint64_t elapsed = test_now_ns() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+
+    report("GetPciLegacyRom 16 images", best, calls);
+}
+
+static void bench_copy(size_t n, int erms)
+{
+    static uint8_t src[256 * 1024 + 64], dst[256 * 1024 + 64];
+    unsigned int calls = (256u << 20) / (n + 64);
+    uint64_t best_cpy = ~0ULL, best_set = ~0ULL;
+    char name[64];
+
+    libc_erms_supported = erms;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        uint64_t start = test_now_ns();
+
+        for (unsigned int i = 0; i < calls; i++) {
+            sink = (uintptr_t)libc_memcpy(dst + (i & 7), src + 1, n);
+        }
+
+        uint64_t mid = test_now_ns();
+
+        for (unsigned int i = 0; i < calls; i++) {
+            sink = (uintptr_t)libc_memset(dst + (i & 7), i, n);
+        }
+
+        uint64_t end = test_now_ns();
+        best_cpy = mid - start < best_cpy ? mid - start : best_cpy;
+        best_set = end - mid < best_set ? end - mid : best_set;
+    }
+
+    snprintf(name, sizeof(name), "memcpy %zu%s", n, erms ? " erms" : "");
+    report(name, best_cpy, calls);
+    snprintf(name, sizeof(name), "memset %zu%s", n, erms ? " erms" : "");
+    report(name, best_set, calls);
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t sizes[] = { 16, 256, 4096, 65536 + 3, 256 * 1024 };
+
+    test_init(argc, argv);
+
+    bench_e820(64);
+    bench_e820(512);
+    bench_e820(4096);
+    bench_oprom();
+    for (int erms = 0; erms <= 1; erms++) {
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            bench_copy(sizes[i], erms);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * Host replacements for what the firmware build links in.
+ */
+
+#include <stdarg.h>
+#include <string.h>
+
+#include "test.h"
+
+int test_failures;
+int test_verbose;
+
+/* Modules under test are built with -Dprintf=host_printf, quiet unless -v */
+int host_printf(const char *restrict fmt, ...)
+{
+    va_list ap;
+    int ret;
+
+    if (!test_verbose) {
+        return 0;
+    }
+
+    va_start(ap, fmt);
+    ret = vprintf(fmt, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+void test_init(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            test_verbose = 1;
+        }
+    }
+}
+
+int test_finish(const char *name)
+{
+    if (test_failures) {
+        printf("%s: %d checks failed\n", name, test_failures);
+        return 1;
+    }
+
+    printf("%s: ok\n", name);
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * Host stand-in for the nyu-efi headers, enough for the modules built by
+ * "make test" and "make bench". Protocols the tested code only passes
+ * around by pointer are left incomplete.
+ */
+
+#ifndef TEST_EFI_H
+#define TEST_EFI_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef uint8_t     UINT8;
+typedef uint16_t    UINT16;
+typedef uint32_t    UINT32;
+typedef uint64_t    UINT64;
+typedef int8_t      INT8;
+typedef int16_t     INT16;
+typedef int32_t     INT32;
+typedef int64_t     INT64;
+typedef uintptr_t   UINTN;
+typedef intptr_t    INTN;
+typedef uint8_t     BOOLEAN;
+typedef uint16_t    CHAR16;
+typedef char        CHAR8;
+typedef void        VOID;
+
+typedef UINTN       EFI_STATUS;
+typedef void        *EFI_HANDLE;
+typedef UINT64      EFI_PHYSICAL_ADDRESS;
+typedef UINT64      EFI_VIRTUAL_ADDRESS;
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define CONST       const
+#define EFIAPI
+
+#define TRUE        1
+#define FALSE       0
+
+#define EFIERR(a)               (((UINTN)1 << (sizeof(UINTN) * 8 - 1)) | (a))
+#define EFI_ERROR(a)            (((INTN)(a)) < 0)
+#define EFI_SUCCESS             0
+#define EFI_INVALID_PARAMETER   EFIERR(2)
+#define EFI_UNSUPPORTED         EFIERR(3)
+#define EFI_NOT_FOUND           EFIERR(14)
+
+#define EFI_PAGE_SIZE           4096
+#define EFI_PAGE_SHIFT          12
+
+#define EFI_SIGNATURE_16(A, B)              ((A) | ((B) << 8))
+#define EFI_SIGNATURE_32(A, B, C, D)        (EFI_SIGNATURE_16(A, B) | (EFI_SIGNATURE_16(C, D) << 16))
+#define EFI_SIGNATURE_64(A, B, C, D, E, F, G, H) \
+    (EFI_SIGNATURE_32(A, B, C, D) | ((UINT64)(EFI_SIGNATURE_32(E, F, G, H)) << 32))
+
+typedef struct {
+    UINT32 Data1;
+    UINT16 Data2;
+    UINT16 Data3;
+    UINT8 Data4[8];
+} EFI_GUID;
+
+typedef enum {
+    EfiReservedMemoryType,
+    EfiLoaderCode,
+    EfiLoaderData,
+    EfiBootServicesCode,
+    EfiBootServicesData,
+    EfiRuntimeServicesCode,
+    EfiRuntimeServicesData,
+    EfiConventionalMemory,
+    EfiUnusableMemory,
+    EfiACPIReclaimMemory,
+    EfiACPIMemoryNVS,
+    EfiMemoryMappedIO,
+    EfiMemoryMappedIOPortSpace,
+    EfiPalCode,
+    EfiPersistentMemory,
+    EfiMaxMemoryType
+} EFI_MEMORY_TYPE;
+
+typedef struct {
+    UINT32 Type;
+    UINT32 Pad;
+    EFI_PHYSICAL_ADDRESS PhysicalStart;
+    EFI_VIRTUAL_ADDRESS VirtualStart;
+    UINT64 NumberOfPages;
+    UINT64 Attribute;
+} EFI_MEMORY_DESCRIPTOR;
+
+#define NextMemoryDescriptor(Ptr, Size) \
+    ((EFI_MEMORY_DESCRIPTOR *)(((UINT8 *)(Ptr)) + (Size)))
+
+typedef struct {
+    UINT8 Type;
+    UINT8 SubType;
+    UINT8 Length[2];
+} EFI_DEVICE_PATH_PROTOCOL;
+typedef EFI_DEVICE_PATH_PROTOCOL EFI_DEVICE_PATH;
+
+typedef struct {
+    EFI_DEVICE_PATH Header;
+    UINT16 DeviceType;
+    UINT16 StatusFlag;
+    CHAR8 String[1];
+} BBS_BBS_DEVICE_PATH;
+
+typedef struct _EFI_BOOT_SERVICES EFI_BOOT_SERVICES;
+typedef struct _EFI_SYSTEM_TABLE EFI_SYSTEM_TABLE;
+typedef struct _EFI_PCI_IO_PROTOCOL EFI_PCI_IO_PROTOCOL;
+typedef struct _EFI_GRAPHICS_OUTPUT_PROTOCOL EFI_GRAPHICS_OUTPUT_PROTOCOL;
+
+#include <edk2/Edk2Compat.h>
+#include <printf.h>
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * Helpers shared by the host-side tests and benchmarks, see "make test".
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+extern int test_failures;
+/* Set by -v, lets the module under test print through host_printf() */
+extern int test_verbose;
+
+#define CHECK(cond, ...)                                            \
+    do {                                                            \
+        if (!(cond)) {                                              \
+            fprintf(stderr, "%s:%d: %s failed: ", __FILE__,         \
+                    __LINE__, #cond);                               \
+            fprintf(stderr, __VA_ARGS__);                           \
+            fprintf(stderr, "\n");                                  \
+            test_failures++;                                        \
+        }                                                           \
+    } while (0)
+
+/* xorshift64*, fixed seeds keep failures reproducible */
+static inline uint64_t test_rand(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+static inline uint64_t test_rand_range(uint64_t *state, uint64_t n)
+{
+    return n ? test_rand(state) % n : 0;
+}
+
+static inline uint64_t test_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void test_init(int argc, char **argv);
+int test_finish(const char *name);
+
+#endif
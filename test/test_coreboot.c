@@ -0,0 +1,79 @@
+/*
+ * CbCheckSum16 against a word-wise IP checksum, and the property the
+ * payload relies on: a table carrying its checksum sums to zero.
+ */
+
+#include <string.h>
+
+/* CbCheckSum16 is static, take the whole file */
+#pragma GCC diagnostic push
+/* build_coreboot_table() writes to its fixed low memory address */
+#pragma GCC diagnostic ignored "-Warray-bounds"
+#pragma GCC diagnostic ignored "-Wstringop-overflow"
+#include "../src/coreboot.c"
+#pragma GCC diagnostic pop
+
+#include "test.h"
+
+struct timestamp_table *timestamp_get_table(void)
+{
+    return NULL;
+}
+
+struct cbmem_console *cbmem_console_get(void)
+{
+    return NULL;
+}
+
+static uint16_t ref_checksum(const uint8_t *p, size_t n)
+{
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i + 1 < n; i += 2) {
+        sum += p[i] | (p[i + 1] << 8);
+    }
+    if (n & 1) {
+        sum += p[n - 1];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return ~sum & 0xffff;
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t buf[8192];
+    uint64_t rng = 0x63627462;
+
+    test_init(argc, argv);
+
+    for (int iter = 0; iter < 20000; iter++) {
+        size_t n = test_rand_range(&rng, 2) ? test_rand_range(&rng, 64)
+                                            : test_rand_range(&rng, sizeof(buf));
+        /* All ones stresses the end around carry */
+        int fill = test_rand_range(&rng, 8);
+
+        for (size_t i = 0; i < n; i++) {
+            buf[i] = fill == 0 ? 0xff : test_rand(&rng);
+        }
+
+        uint16_t sum = CbCheckSum16((UINT16 *)buf, n);
+        CHECK(sum == ref_checksum(buf, n), "n=%zu got %04x want %04x", n, sum,
+              ref_checksum(buf, n));
+
+        if (n >= 2) {
+            size_t field = test_rand_range(&rng, n / 2) * 2;
+
+            buf[field] = buf[field + 1] = 0;
+            sum = CbCheckSum16((UINT16 *)buf, n);
+            buf[field] = sum;
+            buf[field + 1] = sum >> 8;
+            sum = CbCheckSum16((UINT16 *)buf, n);
+            CHECK(sum == 0 || sum == 0xffff, "n=%zu self checksum %04x", n, sum);
+        }
+    }
+
+    return test_finish("coreboot");
+}
@@ -0,0 +1,447 @@
+/*
+ * build_e820_map on generated UEFI memory maps: the result must be
+ * sorted, fit E820_MAX_ENTRIES, have the fixed low 1MB layout and keep
+ * exactly the RAM that UEFI reported above 1MB. Where no compaction was
+ * needed it must also match, entry for entry, the map the original
+ * e820_add() per descriptor implementation builds.
+ */
+
+#include <string.h>
+
+#include <efi.h>
+#include <csmwrap.h>
+#include <ramdisk.h>
+
+#include "test.h"
+
+#define MAX_DESCRIPTORS     1024
+/* Firmware pads descriptors, so does the generator at random */
+#define MAX_DESCRIPTOR_SIZE (sizeof(EFI_MEMORY_DESCRIPTOR) + 16)
+
+static struct csmwrap_priv priv;
+static struct low_stub stub;
+/* Maps that were also checked against the reference */
+static int compared;
+
+struct gen_map {
+    EFI_MEMORY_DESCRIPTOR desc[MAX_DESCRIPTORS];
+    int count;
+    bool overlapping;
+};
+
+static const EFI_MEMORY_TYPE ram_types[] = {
+    EfiConventionalMemory, EfiLoaderCode, EfiLoaderData,
+    EfiBootServicesCode, EfiBootServicesData,
+};
+static const EFI_MEMORY_TYPE other_types[] = {
+    EfiReservedMemoryType, EfiRuntimeServicesCode, EfiRuntimeServicesData,
+    EfiUnusableMemory, EfiACPIReclaimMemory, EfiACPIMemoryNVS,
+    EfiMemoryMappedIO, EfiPalCode,
+};
+
+static bool is_ram_type(EFI_MEMORY_TYPE type)
+{
+    for (size_t i = 0; i < sizeof(ram_types) / sizeof(ram_types[0]); i++) {
+        if (ram_types[i] == type) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void generate_map(struct gen_map *m, uint64_t *rng, int count, bool overlapping)
+{
+    uint64_t addr = 0;
+
+    m->count = count;
+    m->overlapping = overlapping;
+
+    for (int i = 0; i < count; i++) {
+        EFI_MEMORY_DESCRIPTOR *d = &m->desc[i];
+        uint64_t pages;
+
+        /* Gaps, and the odd 1GB+ jump like a PCI hole */
+        if (test_rand_range(rng, 3) == 0) {
+            addr += test_rand_range(rng, 64) * EFI_PAGE_SIZE;
+        }
+        if (test_rand_range(rng, 50) == 0) {
+            addr += (1 + test_rand_range(rng, 4)) << 30;
+        }
+
+        pages = test_rand_range(rng, 8) ? 1 + test_rand_range(rng, 32)
+                                        : 1 + test_rand_range(rng, 1 << 18);
+
+        memset(d, 0, sizeof(*d));
+        d->PhysicalStart = addr;
+        d->NumberOfPages = test_rand_range(rng, 40) ? pages : 0;
+        d->Type = test_rand_range(rng, 2) ?
+                  ram_types[test_rand_range(rng, sizeof(ram_types) / sizeof(ram_types[0]))] :
+                  other_types[test_rand_range(rng, sizeof(other_types) / sizeof(other_types[0]))];
+
+        if (overlapping && test_rand_range(rng, 10) == 0 && addr >= EFI_PAGE_SIZE * 16) {
+            d->PhysicalStart -= test_rand_range(rng, 16) * EFI_PAGE_SIZE;
+        }
+
+        addr = d->PhysicalStart + d->NumberOfPages * EFI_PAGE_SIZE;
+    }
+
+    /* UEFI does not promise a sorted map */
+    if (test_rand_range(rng, 2)) {
+        for (int i = count - 1; i > 0; i--) {
+            int j = test_rand_range(rng, i + 1);
+            EFI_MEMORY_DESCRIPTOR tmp = m->desc[i];
+            m->desc[i] = m->desc[j];
+            m->desc[j] = tmp;
+        }
+    }
+}
+
+/* Packs the map the way GetMemoryMap() returns it, with room to spare */
+static size_t pack_map(const struct gen_map *m, uint8_t *buf, size_t desc_size)
+{
+    for (int i = 0; i < m->count; i++) {
+        memset(buf + i * desc_size, 0xa5, desc_size);
+        memcpy(buf + i * desc_size, &m->desc[i], sizeof(EFI_MEMORY_DESCRIPTOR));
+    }
+
+    return m->count * desc_size;
+}
+
+/* [start, end) holds nothing but entries of the given type in the output */
+static bool output_covers(uint64_t start, uint64_t end, uint32_t type)
+{
+    for (int i = 0; i < stub.e820_entries && start < end; i++) {
+        EFI_E820_ENTRY64 *e = &stub.e820_map[i];
+
+        if (e->BaseAddr + e->Length <= start) {
+            continue;
+        }
+        if (e->BaseAddr > start || e->Type != type) {
+            return false;
+        }
+        start = e->BaseAddr + e->Length;
+    }
+
+    return start >= end;
+}
+
+static bool output_ram_covers(uint64_t start, uint64_t end)
+{
+    return output_covers(start, end, EfiAcpiAddressRangeMemory);
+}
+
+/* [start, end) is covered by RAM descriptors of the input */
+static bool input_ram_covers(const struct gen_map *m, uint64_t start, uint64_t end)
+{
+    bool progress = true;
+
+    while (start < end && progress) {
+        progress = false;
+        for (int i = 0; i < m->count; i++) {
+            const EFI_MEMORY_DESCRIPTOR *d = &m->desc[i];
+            uint64_t d_end = d->PhysicalStart + d->NumberOfPages * EFI_PAGE_SIZE;
+
+            if (is_ram_type(d->Type) && d->PhysicalStart <= start && d_end > start) {
+                start = d_end;
+                progress = true;
+            }
+        }
+    }
+
+    return start >= end;
+}
+
+/*
+ * The original implementation: every descriptor goes through e820_add()
+ * in map order, on a table that silently drops what does not fit.
+ */
+#define REF_HOLE    (-1UL)
+
+struct ref_table {
+    EFI_E820_ENTRY64 map[E820_MAX_ENTRIES];
+    int count;
+    bool overflow;
+};
+
+static void ref_remove(struct ref_table *t, int i)
+{
+    t->count--;
+    memmove(&t->map[i], &t->map[i + 1], sizeof(EFI_E820_ENTRY64) * (t->count - i));
+}
+
+static void ref_insert(struct ref_table *t, int i, uint64_t start, uint64_t size, uint64_t type)
+{
+    if (t->count >= E820_MAX_ENTRIES) {
+        t->overflow = true;
+        return;
+    }
+
+    memmove(&t->map[i + 1], &t->map[i], sizeof(EFI_E820_ENTRY64) * (t->count - i));
+    t->count++;
+    t->map[i].BaseAddr = start;
+    t->map[i].Length = size;
+    t->map[i].Type = type;
+}
+
+static void ref_add(struct ref_table *t, uint64_t start, uint64_t size, uint64_t type)
+{
+    uint64_t end = start + size;
+    int i;
+
+    if (!size) {
+        return;
+    }
+
+    for (i = 0; i < t->count; i++) {
+        EFI_E820_ENTRY64 *e = &t->map[i];
+        uint64_t e_end = e->BaseAddr + e->Length;
+
+        if (start > e_end) {
+            continue;
+        }
+        if (start > e->BaseAddr) {
+            if (type == e->Type) {
+                size += start - e->BaseAddr;
+                start = e->BaseAddr;
+            } else {
+                e->Length = start - e->BaseAddr;
+                i++;
+                if (e_end > end) {
+                    ref_insert(t, i, end, e_end - end, e->Type);
+                }
+            }
+        }
+        break;
+    }
+    while (i < t->count) {
+        EFI_E820_ENTRY64 *e = &t->map[i];
+        uint64_t e_end = e->BaseAddr + e->Length;
+
+        if (end < e->BaseAddr) {
+            break;
+        }
+        if (end >= e_end) {
+            ref_remove(t, i);
+            continue;
+        }
+        e->BaseAddr = end;
+        e->Length = e_end - end;
+        if (type == e->Type) {
+            size += e->Length;
+            ref_remove(t, i);
+        }
+        break;
+    }
+    if (type != REF_HOLE) {
+        ref_insert(t, i, start, size, type);
+    }
+}
+
+static uint32_t ref_type(EFI_MEMORY_TYPE type)
+{
+    if (is_ram_type(type)) {
+        return EfiAcpiAddressRangeMemory;
+    }
+    switch (type) {
+    case EfiACPIReclaimMemory: return EfiAcpiAddressRangeACPI;
+    case EfiACPIMemoryNVS:     return EfiAcpiAddressRangeNVS;
+    default:                   return EfiAcpiAddressRangeReserved;
+    }
+}
+
+static void ref_build(struct ref_table *t, const struct gen_map *m, bool ramdisk)
+{
+    memset(t, 0, sizeof(*t));
+
+    for (int i = 0; i < m->count; i++) {
+        const EFI_MEMORY_DESCRIPTOR *d = &m->desc[i];
+
+        ref_add(t, d->PhysicalStart, d->NumberOfPages * EFI_PAGE_SIZE, ref_type(d->Type));
+    }
+
+    ref_add(t, 0, 0x100000, REF_HOLE);
+    ref_add(t, 0, 0x80000, EfiAcpiAddressRangeMemory);
+    ref_add(t, EBDA_BASE, 0x20000, EfiAcpiAddressRangeReserved);
+    ref_add(t, 0xa0000, 0x100000 - 0xa0000, EfiAcpiAddressRangeReserved);
+    if (ramdisk) {
+        ref_add(t, RAMDISK_HANDLER_BASE, RAMDISK_HANDLER_SIZE, EfiAcpiAddressRangeReserved);
+        ref_add(t, priv.ramdisk_base, ALIGN_UP(priv.ramdisk_size, EFI_PAGE_SIZE),
+                EfiAcpiAddressRangeReserved);
+    }
+}
+
+/* Without compaction both must give the very same map */
+static void check_reference(const struct gen_map *m, bool ramdisk)
+{
+    static struct ref_table ref;
+
+    if (m->overlapping || priv.e820_merged || priv.e820_dropped) {
+        return;
+    }
+
+    ref_build(&ref, m, ramdisk);
+    if (ref.overflow) {
+        return;
+    }
+
+    CHECK(ref.count == stub.e820_entries, "%d entries, reference has %d",
+          stub.e820_entries, ref.count);
+    for (int i = 0; i < ref.count && i < stub.e820_entries; i++) {
+        const EFI_E820_ENTRY64 *e = &stub.e820_map[i];
+        const EFI_E820_ENTRY64 *r = &ref.map[i];
+
+        CHECK(e->BaseAddr == r->BaseAddr && e->Length == r->Length && e->Type == r->Type,
+              "entry %d is %llx+%llx type %u, reference %llx+%llx type %u", i,
+              (unsigned long long)e->BaseAddr, (unsigned long long)e->Length, e->Type,
+              (unsigned long long)r->BaseAddr, (unsigned long long)r->Length, r->Type);
+    }
+    compared++;
+}
+
+static void check_map(const struct gen_map *m, bool ramdisk)
+{
+    const EFI_E820_ENTRY64 *map = stub.e820_map;
+    int count = stub.e820_entries;
+    uint64_t low_ram_end = ramdisk ? RAMDISK_HANDLER_BASE : 0x80000;
+
+    CHECK(count > 0 && count <= E820_MAX_ENTRIES, "%d entries", count);
+
+    for (int i = 0; i < count; i++) {
+        CHECK(map[i].Length != 0, "entry %d is empty", i);
+        if (i > 0) {
+            CHECK(map[i - 1].BaseAddr + map[i - 1].Length <= map[i].BaseAddr,
+                  "entries %d and %d overlap or are unsorted", i - 1, i);
+        }
+    }
+
+    /* Low 1MB: RAM, then EBDA and the BIOS areas reserved in one piece */
+    CHECK(count >= 2 && map[0].BaseAddr == 0 && map[0].Length == low_ram_end &&
+          map[0].Type == EfiAcpiAddressRangeMemory,
+          "low RAM %llx+%llx type %u", (unsigned long long)map[0].BaseAddr,
+          (unsigned long long)map[0].Length, map[0].Type);
+    CHECK(count >= 2 && map[1].BaseAddr == low_ram_end &&
+          map[1].BaseAddr + map[1].Length >= 0x100000 &&
+          map[1].Type == EfiAcpiAddressRangeReserved,
+          "low reserved %llx+%llx type %u", (unsigned long long)map[1].BaseAddr,
+          (unsigned long long)map[1].Length, map[1].Type);
+
+    if (priv.e820_merged || priv.e820_dropped) {
+        CHECK(count == E820_MAX_ENTRIES, "compacted to %d entries", count);
+    }
+
+    /* Our own reservations survive compaction, unless the top was cut off */
+    for (unsigned int i = 0; i < priv.e820_keep_count && !m->overlapping; i++) {
+        uint64_t start = priv.e820_keep[i].base;
+        uint64_t end = start + priv.e820_keep[i].size;
+
+        if (start >= map[count - 1].BaseAddr + map[count - 1].Length) {
+            continue;
+        }
+        CHECK(output_covers(start, end, EfiAcpiAddressRangeReserved),
+              "kept range %llx-%llx lost", (unsigned long long)start,
+              (unsigned long long)end);
+    }
+
+    if (m->overlapping || priv.e820_dropped) {
+        return;
+    }
+
+    /* Compaction may merge reserved ranges but never touches RAM */
+    for (int i = 0; i < m->count; i++) {
+        const EFI_MEMORY_DESCRIPTOR *d = &m->desc[i];
+        uint64_t start = d->PhysicalStart;
+        uint64_t end = start + d->NumberOfPages * EFI_PAGE_SIZE;
+
+        if (!is_ram_type(d->Type) || end <= 0x100000) {
+            continue;
+        }
+        if (start < 0x100000) {
+            start = 0x100000;
+        }
+        if (ramdisk) {
+            /* The image is reserved on top of whatever was there */
+            uint64_t rd_start = priv.ramdisk_base;
+            uint64_t rd_end = rd_start + priv.ramdisk_size;
+
+            if (start < rd_start) {
+                CHECK(output_ram_covers(start, end < rd_start ? end : rd_start),
+                      "RAM %llx-%llx lost", (unsigned long long)start,
+                      (unsigned long long)end);
+            }
+            if (end > rd_end) {
+                start = start > rd_end ? start : rd_end;
+            } else {
+                continue;
+            }
+        }
+        CHECK(output_ram_covers(start, end), "RAM %llx-%llx lost",
+              (unsigned long long)start, (unsigned long long)end);
+    }
+
+    for (int i = 0; i < count; i++) {
+        uint64_t start = map[i].BaseAddr;
+        uint64_t end = start + map[i].Length;
+
+        if (map[i].Type != EfiAcpiAddressRangeMemory || end <= 0x100000) {
+            continue;
+        }
+        CHECK(input_ram_covers(m, start, end), "RAM %llx-%llx made up",
+              (unsigned long long)start, (unsigned long long)end);
+    }
+}
+
+static void run_one(struct gen_map *m, uint64_t *rng)
+{
+    static uint8_t buf[MAX_DESCRIPTORS * MAX_DESCRIPTOR_SIZE];
+    size_t desc_size = sizeof(EFI_MEMORY_DESCRIPTOR) + 8 * test_rand_range(rng, 3);
+    bool ramdisk = test_rand_range(rng, 4) == 0;
+    size_t size = pack_map(m, buf, desc_size);
+
+    memset(&stub, 0, sizeof(stub));
+    priv.low_stub = &stub;
+    priv.ramdisk_size = ramdisk ? 0x100000 : 0;
+    priv.ramdisk_base = 0x10000000;
+    priv.e820_merged = 0;
+    priv.e820_dropped = 0;
+    priv.e820_keep_count = 0;
+    if (ramdisk) {
+        e820_keep(&priv, priv.ramdisk_base, priv.ramdisk_size);
+    }
+    /* Like HiPmm, a runtime data allocation of ours somewhere in the map */
+    if (test_rand_range(rng, 2)) {
+        const EFI_MEMORY_DESCRIPTOR *d = &m->desc[test_rand_range(rng, m->count)];
+
+        if (d->Type == EfiRuntimeServicesData && d->PhysicalStart >= 0x100000) {
+            e820_keep(&priv, d->PhysicalStart, d->NumberOfPages * EFI_PAGE_SIZE);
+        }
+    }
+
+    build_e820_map(&priv, (EFI_MEMORY_DESCRIPTOR *)buf, size, desc_size);
+    check_map(m, ramdisk);
+    check_reference(m, ramdisk);
+}
+
+int main(int argc, char **argv)
+{
+    static struct gen_map m;
+    uint64_t rng = 0x65383230;
+
+    test_init(argc, argv);
+
+    for (int iter = 0; iter < 3000; iter++) {
+        /*
+         * Small maps, then server sized ones that need compaction. The
+         * builder stages in the map buffer itself, which only has room
+         * for the low 1MB fixups from a handful of descriptors on.
+         */
+        int count = iter % 3 == 0 ? 8 + test_rand_range(&rng, MAX_DESCRIPTORS - 8)
+                                  : 8 + test_rand_range(&rng, 56);
+
+        generate_map(&m, &rng, count, iter % 7 == 0);
+        run_one(&m, &rng);
+    }
+
+    CHECK(compared > 1000, "only %d maps compared with the reference", compared);
+
+    return test_finish("e820");
+}
@@ -0,0 +1,161 @@
+/*
+ * src/libc.c against byte-wise references, on both the ERMS and the
+ * word-sized paths, for every alignment and around the word boundaries.
+ */
+
+#include <string.h>
+
+#include "test.h"
+
+/* libc.c is linked with its symbols renamed, see GNUmakefile */
+void *libc_memcpy(void *restrict dest, const void *restrict src, size_t n);
+void *libc_memset(void *s, int c, size_t n);
+void *libc_memmove(void *dest, const void *src, size_t n);
+int libc_memcmp(const void *s1, const void *s2, size_t n);
+extern int libc_erms_supported;
+
+#define BUF_SIZE    8192
+#define GUARD       64
+
+static uint8_t buf[BUF_SIZE], ref[BUF_SIZE];
+
+static void fill_random(uint8_t *p, size_t n, uint64_t *rng)
+{
+    for (size_t i = 0; i < n; i++) {
+        p[i] = test_rand(rng);
+    }
+}
+
+static size_t random_length(uint64_t *rng)
+{
+    /* Mostly short, around the word thresholds, sometimes pages */
+    switch (test_rand_range(rng, 4)) {
+    case 0:
+        return test_rand_range(rng, 4 * sizeof(unsigned long));
+    case 1:
+        return test_rand_range(rng, 256);
+    case 2:
+        return test_rand_range(rng, 2048);
+    default:
+        return test_rand_range(rng, BUF_SIZE / 2 - 2 * GUARD);
+    }
+}
+
+static void test_memcpy(uint64_t *rng)
+{
+    static uint8_t src[BUF_SIZE];
+
+    for (int iter = 0; iter < 20000; iter++) {
+        size_t n = random_length(rng);
+        size_t doff = GUARD + test_rand_range(rng, 16);
+        size_t soff = test_rand_range(rng, 16);
+        void *ret;
+
+        fill_random(buf, sizeof(buf), rng);
+        fill_random(src, sizeof(src), rng);
+        memcpy(ref, buf, sizeof(buf));
+        for (size_t i = 0; i < n; i++) {
+            ref[doff + i] = src[soff + i];
+        }
+
+        ret = libc_memcpy(buf + doff, src + soff, n);
+        CHECK(ret == buf + doff, "memcpy returned %p", ret);
+        CHECK(memcmp(buf, ref, sizeof(buf)) == 0,
+              "memcpy n=%zu doff=%zu soff=%zu erms=%d", n, doff, soff, libc_erms_supported);
+    }
+}
+
+static void test_memset(uint64_t *rng)
+{
+    for (int iter = 0; iter < 20000; iter++) {
+        size_t n = random_length(rng);
+        size_t off = GUARD + test_rand_range(rng, 16);
+        int c = (int)test_rand(rng);
+        void *ret;
+
+        fill_random(buf, sizeof(buf), rng);
+        memcpy(ref, buf, sizeof(buf));
+        for (size_t i = 0; i < n; i++) {
+            ref[off + i] = (uint8_t)c;
+        }
+
+        ret = libc_memset(buf + off, c, n);
+        CHECK(ret == buf + off, "memset returned %p", ret);
+        CHECK(memcmp(buf, ref, sizeof(buf)) == 0,
+              "memset n=%zu off=%zu c=%#x erms=%d", n, off, c, libc_erms_supported);
+    }
+}
+
+static void test_memmove(uint64_t *rng)
+{
+    static uint8_t tmp[BUF_SIZE];
+
+    for (int iter = 0; iter < 20000; iter++) {
+        size_t n = random_length(rng);
+        size_t doff = GUARD + test_rand_range(rng, BUF_SIZE - n - 2 * GUARD);
+        size_t soff = GUARD + test_rand_range(rng, BUF_SIZE - n - 2 * GUARD);
+        void *ret;
+
+        /* Overlap on purpose half of the time */
+        if (test_rand_range(rng, 2) && n) {
+            size_t shift = test_rand_range(rng, n < 32 ? n + 1 : 32);
+            soff = doff + shift <= BUF_SIZE - GUARD - n ? doff + shift : doff - shift;
+            if (test_rand_range(rng, 2)) {
+                size_t t = soff;
+                soff = doff;
+                doff = t;
+            }
+        }
+
+        fill_random(buf, sizeof(buf), rng);
+        memcpy(ref, buf, sizeof(buf));
+        memcpy(tmp, buf + soff, n);
+        memcpy(ref + doff, tmp, n);
+
+        ret = libc_memmove(buf + doff, buf + soff, n);
+        CHECK(ret == buf + doff, "memmove returned %p", ret);
+        CHECK(memcmp(buf, ref, sizeof(buf)) == 0,
+              "memmove n=%zu doff=%zu soff=%zu erms=%d", n, doff, soff, libc_erms_supported);
+    }
+}
+
+static int sign(int v)
+{
+    return (v > 0) - (v < 0);
+}
+
+static void test_memcmp(uint64_t *rng)
+{
+    static uint8_t other[BUF_SIZE];
+
+    for (int iter = 0; iter < 20000; iter++) {
+        size_t n = random_length(rng);
+
+        fill_random(buf, n, rng);
+        memcpy(other, buf, n);
+        if (n && test_rand_range(rng, 2)) {
+            other[test_rand_range(rng, n)] = test_rand(rng);
+        }
+
+        CHECK(sign(libc_memcmp(buf, other, n)) == sign(memcmp(buf, other, n)),
+              "memcmp n=%zu", n);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t rng = 0x6c696263;
+
+    test_init(argc, argv);
+
+    /* Force both copy strategies regardless of the host CPU */
+    for (int erms = 0; erms <= 1; erms++) {
+        libc_erms_supported = erms;
+        test_memcpy(&rng);
+        test_memset(&rng);
+        test_memmove(&rng);
+    }
+    test_memcmp(&rng);
+
+    return test_finish("libc");
+}
@@ -0,0 +1,206 @@
+/*
+ * GetPciLegacyRom on hand-built expansion ROMs, then on mutated ones in
+ * exactly sized buffers so the sanitizers catch any read past the end.
+ */
+
+#include <string.h>
+
+#include <efi.h>
+#include <csmwrap.h>
+#include <oprom.h>
+
+#include "test.h"
+
+#define VENDOR      0x8086
+#define DEVICE      0x1234
+#define PCIR_OFFSET 0x1c
+
+struct rom_image {
+    uint16_t vendor;
+    uint16_t device;
+    uint8_t revision;
+    uint8_t code_type;
+    uint16_t blocks;
+    uint16_t max_runtime_blocks;
+    /* Zero terminated, rev 3 only */
+    const uint16_t *device_list;
+};
+
+/* Lays the images out back to back, returns the ROM size */
+static size_t build_rom(uint8_t *rom, const struct rom_image *images, int count)
+{
+    size_t off = 0;
+
+    for (int i = 0; i < count; i++) {
+        const struct rom_image *img = &images[i];
+        uint8_t *p = rom + off;
+        PCI_3_0_DATA_STRUCTURE *pcir = (PCI_3_0_DATA_STRUCTURE *)(p + PCIR_OFFSET);
+
+        memset(p, 0, img->blocks * 512);
+        p[0] = 0x55;
+        p[1] = 0xaa;
+        p[2] = img->blocks;
+        p[0x18] = PCIR_OFFSET;
+
+        pcir->Signature = PCI_DATA_STRUCTURE_SIGNATURE;
+        pcir->VendorId = img->vendor;
+        pcir->DeviceId = img->device;
+        pcir->Length = img->revision >= 3 ? sizeof(PCI_3_0_DATA_STRUCTURE) : sizeof(PCI_DATA_STRUCTURE);
+        pcir->Revision = img->revision;
+        pcir->ImageLength = img->blocks;
+        pcir->CodeType = img->code_type;
+        pcir->Indicator = i == count - 1 ? 0x80 : 0;
+        if (img->revision >= 3) {
+            pcir->MaxRuntimeImageLength = img->max_runtime_blocks;
+            if (img->device_list) {
+                size_t n = 0;
+
+                pcir->DeviceListOffset = sizeof(PCI_3_0_DATA_STRUCTURE);
+                do {
+                    memcpy((uint8_t *)pcir + pcir->DeviceListOffset + 2 * n,
+                           &img->device_list[n], 2);
+                } while (img->device_list[n++]);
+            }
+        }
+
+        off += img->blocks * 512;
+    }
+
+    return off;
+}
+
+static EFI_STATUS find(uint16_t csm16_revision, uint8_t *rom, size_t size,
+                       void **image, UINTN *image_size, UINTN *max_runtime)
+{
+    *image = rom;
+    *image_size = size;
+
+    return GetPciLegacyRom(csm16_revision, VENDOR, DEVICE, image, image_size,
+                           max_runtime, NULL, NULL);
+}
+
+static void test_selection(void)
+{
+    static uint8_t rom[64 * 1024];
+    static const uint16_t device_list[] = { 0x1111, DEVICE, 0 };
+    void *image;
+    UINTN image_size, max_runtime;
+    EFI_STATUS status;
+    size_t size;
+
+    /* A lone PC-AT image */
+    size = build_rom(rom, (struct rom_image[]) {
+        { VENDOR, DEVICE, 3, PCI_CODE_TYPE_PCAT_IMAGE, 8, 12, NULL },
+    }, 1);
+    status = find(0x0300, rom, size, &image, &image_size, &max_runtime);
+    CHECK(status == EFI_SUCCESS, "status %lx", (unsigned long)status);
+    CHECK(image == rom && image_size == 8 * 512, "image %p size %lu", image, (unsigned long)image_size);
+    CHECK(max_runtime == 12 * 512, "max runtime %lu", (unsigned long)max_runtime);
+
+    /* EFI image first */
+    size = build_rom(rom, (struct rom_image[]) {
+        { VENDOR, DEVICE, 3, 3, 16, 0, NULL },
+        { VENDOR, DEVICE, 3, PCI_CODE_TYPE_PCAT_IMAGE, 4, 0, NULL },
+    }, 2);
+    status = find(0x0300, rom, size, &image, &image_size, NULL);
+    CHECK(status == EFI_SUCCESS && image == rom + 16 * 512 && image_size == 4 * 512,
+          "status %lx image %p", (unsigned long)status, image);
+
+    /* 2.x and 3.0 images, the CSM revision picks */
+    size = build_rom(rom, (struct rom_image[]) {
+        { VENDOR, DEVICE, 2, PCI_CODE_TYPE_PCAT_IMAGE, 4, 0, NULL },
+        { VENDOR, DEVICE, 3, PCI_CODE_TYPE_PCAT_IMAGE, 6, 0, NULL },
+    }, 2);
+    status = find(0x0300, rom, size, &image, &image_size, &max_runtime);
+    CHECK(status == EFI_SUCCESS && image == rom + 4 * 512, "3.0 CSM got %p", image);
+    status = find(0x0200, rom, size, &image, &image_size, &max_runtime);
+    CHECK(status == EFI_SUCCESS && image == rom && max_runtime == 0, "2.x CSM got %p", image);
+
+    /* Only a backup match */
+    size = build_rom(rom, (struct rom_image[]) {
+        { VENDOR, DEVICE, 2, PCI_CODE_TYPE_PCAT_IMAGE, 4, 0, NULL },
+    }, 1);
+    status = find(0x0300, rom, size, &image, &image_size, NULL);
+    CHECK(status == EFI_SUCCESS && image == rom, "backup got %p", image);
+
+    /* Device list of a 3.0 image */
+    size = build_rom(rom, (struct rom_image[]) {
+        { VENDOR, 0x9999, 3, PCI_CODE_TYPE_PCAT_IMAGE, 4, 0, device_list },
+    }, 1);
+    status = find(0x0300, rom, size, &image, &image_size, NULL);
+    CHECK(status == EFI_SUCCESS && image == rom, "device list got %lx", (unsigned long)status);
+
+    /* Wrong vendor, and an image running past the ROM */
+    size = build_rom(rom, (struct rom_image[]) {
+        { 0x10de, DEVICE, 3, PCI_CODE_TYPE_PCAT_IMAGE, 4, 0, NULL },
+    }, 1);
+    status = find(0x0300, rom, size, &image, &image_size, NULL);
+    CHECK(status == EFI_NOT_FOUND, "wrong vendor %lx", (unsigned long)status);
+
+    size = build_rom(rom, (struct rom_image[]) {
+        { VENDOR, DEVICE, 3, PCI_CODE_TYPE_PCAT_IMAGE, 4, 0, NULL },
+    }, 1);
+    status = find(0x0300, rom, size - 512, &image, &image_size, NULL);
+    CHECK(status == EFI_NOT_FOUND, "truncated %lx", (unsigned long)status);
+
+    status = find(0x0300, rom, 8, &image, &image_size, NULL);
+    CHECK(status == EFI_NOT_FOUND, "tiny %lx", (unsigned long)status);
+}
+
+static void test_fuzz(void)
+{
+    static uint8_t seed_rom[64 * 1024];
+    static const uint16_t device_list[] = { 0x1111, 0x2222, DEVICE, 0 };
+    uint64_t rng = 0x6f70726f6d;
+    size_t seed_size;
+
+    seed_size = build_rom(seed_rom, (struct rom_image[]) {
+        { VENDOR, DEVICE, 3, 3, 4, 0, NULL },
+        { VENDOR, 0x9999, 3, PCI_CODE_TYPE_PCAT_IMAGE, 2, 0, device_list },
+        { VENDOR, DEVICE, 2, PCI_CODE_TYPE_PCAT_IMAGE, 2, 0, NULL },
+    }, 3);
+
+    for (int iter = 0; iter < 200000; iter++) {
+        size_t size = 1 + test_rand_range(&rng, seed_size);
+        /* Exact size, so ASan flags reads past the given length */
+        uint8_t *rom = malloc(size);
+        int mutations = 1 + test_rand_range(&rng, 8);
+        void *image, *config;
+        UINTN image_size, max_runtime;
+        UINT8 revision;
+        EFI_STATUS status;
+
+        memcpy(rom, seed_rom, size);
+        for (int i = 0; i < mutations; i++) {
+            /* Mostly aim at the headers, where the parser looks */
+            size_t block = test_rand_range(&rng, seed_size / 512) * 512;
+            size_t off = test_rand_range(&rng, 4) ? block + test_rand_range(&rng, 0x40)
+                                                  : test_rand_range(&rng, size);
+            if (off < size) {
+                rom[off] = test_rand(&rng);
+            }
+        }
+
+        image = rom;
+        image_size = size;
+        status = GetPciLegacyRom(0x0300, VENDOR, DEVICE, &image, &image_size,
+                                 &max_runtime, &revision, &config);
+        if (status == EFI_SUCCESS) {
+            CHECK((uint8_t *)image >= rom && (uint8_t *)image + image_size <= rom + size,
+                  "image %p+%lu outside ROM %p+%zu", image, (unsigned long)image_size,
+                  rom, size);
+        }
+
+        free(rom);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    test_init(argc, argv);
+
+    test_selection();
+    test_fuzz();
+
+    return test_finish("oprom");
+}